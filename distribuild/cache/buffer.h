@@ -0,0 +1,45 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace distribuild::cache {
+
+/// @brief 不可变的引用计数缓冲区
+/// 多个读者共享同一块内存，不需要复制，最后一个引用释放时由owner回收内存
+class Buffer {
+ public:
+  Buffer() = default;
+
+  Buffer(std::shared_ptr<const void> owner, const char* data, std::size_t size)
+    : owner_(std::move(owner)), data_(data), size_(size) {}
+
+  /// @brief 接管字符串
+  explicit Buffer(std::string bytes) {
+    auto owner = std::make_shared<const std::string>(std::move(bytes));
+    data_ = owner->data();
+    size_ = owner->size();
+    owner_ = std::move(owner);
+  }
+
+  const char* data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  std::string_view View() const noexcept { return {data_, size_}; }
+
+  /// @brief 截取一段，与原缓冲区共享内存
+  Buffer Slice(std::size_t pos, std::size_t len) const {
+    pos = std::min(pos, size_);
+    return Buffer(owner_, data_ + pos, std::min(len, size_ - pos));
+  }
+
+  /// @brief 复制为字符串
+  std::string ToString() const { return std::string(data_, size_); }
+
+ private:
+  std::shared_ptr<const void> owner_;
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+} // namespace distribuild::cache
@@ -0,0 +1,42 @@
+#include "cache/cache_engine.h"
+
+namespace distribuild::cache {
+
+namespace {
+
+/// @brief 在内存中拼接，Commit时调用Put
+class BufferedEntryWriter : public EntryWriter {
+ public:
+  BufferedEntryWriter(CacheEngine* engine, std::string key, std::uint32_t cost_ms)
+    : engine_(engine), key_(std::move(key)), cost_ms_(cost_ms) {}
+
+  bool Append(std::string_view bytes) override {
+    bytes_.append(bytes);
+    return true;
+  }
+
+  bool Commit() override {
+    engine_->Put(key_, bytes_, cost_ms_);
+    Abort();
+    return true;
+  }
+
+  void Abort() override {
+    bytes_.clear();
+    bytes_.shrink_to_fit();
+  }
+
+ private:
+  CacheEngine* engine_;
+  std::string key_;
+  std::uint32_t cost_ms_;
+  std::string bytes_;
+};
+
+} // namespace
+
+std::unique_ptr<EntryWriter> CacheEngine::BeginPut(const std::string& key, std::uint32_t cost_ms) {
+  return std::make_unique<BufferedEntryWriter>(this, key, cost_ms);
+}
+
+} // namespace distribuild::cache
@@ -1,18 +1,64 @@
 #pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <optional>
+#include "cache/buffer.h"
 
 namespace distribuild::cache {
 
+/// @brief 流式写入一个缓存条目，Commit之前条目对读者不可见，
+/// 未Commit就析构等同于Abort
+class EntryWriter {
+ public:
+  virtual ~EntryWriter() = default;
+  /// @brief 追加数据，失败后不能再继续写入
+  virtual bool Append(std::string_view bytes) = 0;
+  /// @brief 发布条目
+  virtual bool Commit() = 0;
+  /// @brief 丢弃已写入的数据
+  virtual void Abort() = 0;
+};
+
 class CacheEngine {
 public:
   virtual ~CacheEngine() = default;
   virtual std::vector<std::string> GetKeys() = 0;
-  virtual std::optional<std::string> TryGet(const std::string& key) = 0;
-  virtual void Put(const std::string& key, const std::string& bytes) = 0;
+  virtual std::optional<Buffer> TryGet(const std::string& key) = 0;
+  /// @brief 读取条目但不计入命中，不影响淘汰顺序，用于服务器内部查看条目内容
+  virtual std::optional<Buffer> Peek(const std::string& key) { return TryGet(key); }
+  /// @param cost_ms 生成该条目的编译耗时，0表示未知
+  virtual void Put(const std::string& key, std::string_view bytes, std::uint32_t cost_ms) = 0;
   virtual void Purge() = 0;
+
+  /// @brief 开始流式写入，默认在内存中拼接后Put；返回nullptr表示不接受写入
+  virtual std::unique_ptr<EntryWriter> BeginPut(const std::string& key, std::uint32_t cost_ms);
+
+  /// @brief 空间将满时，写入key最先会淘汰的条目；空间充足时返回空
+  virtual std::optional<std::string> GetEvictionCandidate(const std::string& key) { return std::nullopt; }
+
+  /// @brief 条目加入（inserted为true）或移出时的回调
+  /// 调用时持有引擎内部的锁，同一个key的通知顺序与实际顺序一致，回调中不能再调用引擎
+  using Observer = std::function<void(const std::string& key, bool inserted)>;
+
+  /// @brief 设置回调，需在Start之前调用
+  void SetObserver(Observer observer) { observer_ = std::move(observer); }
+
+  /// @brief 启动后台任务（可能加入或移出条目），需在SetObserver之后、开始读写之前调用
+  virtual void Start() {}
+
+protected:
+  void Notify(const std::string& key, bool inserted) {
+    if (observer_) {
+      observer_(key, inserted);
+    }
+  }
+
+private:
+  Observer observer_;
 };
 
 } // namespace distribuild::cache
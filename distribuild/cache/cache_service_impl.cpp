@@ -1,23 +1,143 @@
+#include <algorithm>
+#include <functional>
 #include <gflags/gflags.h>
+#include <grpcpp/create_channel.h>
 #include "cache/cache_service_impl.h"
+#include "cache/memory_cache.h"
+#include "cache/disk_cache.h"
+#include "common/cache_format.h"
 #include "common/spdlogging.h"
-#include "cache_service_impl.h"
+#include "common/tools.h"
+#include "common/hash.h"
 
 DEFINE_uint64(chunk_size, 1 * 1024 * 1024, "发送文件的分块大小，默认1M");
+DEFINE_uint32(max_batch_keys, 256, "TryGetEntries一次最多查询的键数");
 
 DEFINE_string(user_token, "nieyang", "local使用的token");
 DEFINE_string(servant_token, "nieyang", "daemon cloud使用的token");
 
+DEFINE_string(l1_cache_engine, "memory", "L1缓存类型：memory、null");
+DEFINE_string(l1_cache_size, "1G", "L1缓存大小上限");
+DEFINE_string(l2_cache_engine, "disk", "L2缓存类型：disk、null");
+DEFINE_string(l2_cache_size, "100G", "L2缓存大小上限");
+DEFINE_string(disk_cache_dir, "./distribuild_cache", "磁盘缓存目录");
+DEFINE_bool(disk_cache_dedup, false, "磁盘缓存按内容定义分块去重，相同的块只存一份，切换时需清空磁盘缓存目录");
+DEFINE_string(max_pending_put_size, "512M", "所有正在上传、尚未发布的缓存条目总大小上限");
+DEFINE_string(dictionary_dir, "./distribuild_dictionaries", "zstd字典保存目录，为空则不保存");
+DEFINE_string(dictionary_server, "", "训练zstd字典的节点地址，为空时由本节点训练；集群中只应有一个节点"
+              "（daemon配置的第一个节点）训练，其余节点配置为它的地址，从它同步字典");
+DEFINE_string(dictionary_server_token, "nieyang", "向训练字典的节点获取字典使用的token");
+
+using namespace std::literals;
+
 namespace distribuild::cache {
 
+namespace {
+
+constexpr auto kFullFetchInterval = 10min;          // 客户端超过该时间未全量更新时返回整个布隆过滤器，以移除已淘汰的key
+constexpr auto kChangesWindow = 15min;              // 变更至少保留的时长
+constexpr std::size_t kMinBloomFilterKeys = 1 << 18; // 布隆过滤器的最小容量
+constexpr std::size_t kFrequencySketchKeys = 1 << 20; // 访问频率估计区分的key数
+constexpr long kTrainDictionaryIntervalMs = 3'600'000; // 训练字典的间隔，1h
+constexpr std::size_t kHotKeysCapacity = 1 << 16;     // 跟踪命中次数的key数
+constexpr std::size_t kMaxHotKeys = 4096;             // FetchHotKeys一次最多返回的key数
+constexpr long kDecayHotKeysIntervalMs = 3'600'000;  // 命中次数减半的间隔，1h
+constexpr std::uint32_t kMinPromoteAccesses = 3;     // L2命中时近期访问次数（含写入）达到该值才复制到L1，只读一次的条目不占用内存
+
+/// @brief 追加版本大于generation的变更
+template <class Iter>
+void AddChangesSince(Iter begin, Iter end, std::uint64_t generation, FetchBloomFilterResponse* response) {
+  auto iter = std::partition_point(begin, end, [&](auto&& e) { return e.generation <= generation; });
+  for (; iter != end; ++iter) {
+	if (iter->removed) {
+	  response->add_removed_hashes(iter->hash);
+	} else {
+	  response->add_newly_populated_hashes(iter->hash);
+	}
+  }
+}
+
+/// @brief 条目中文件使用的字典，只解析文件表，不读取整个条目
+std::vector<std::uint32_t> GetDictionaryIds(std::string_view data) {
+  std::vector<std::uint32_t> ids;
+  auto entry = TryParseCacheEntryView(data, false);
+  if (!entry) {
+	return ids;
+  }
+  for (auto&& [_, content] : entry->files) {
+	if (auto id = ZSTDGetDictId(content); id && std::find(ids.begin(), ids.end(), id) == ids.end()) {
+	  ids.push_back(id);
+	}
+  }
+  return ids;
+}
+
+/// @brief 不缓存任何内容，用于关闭某一级缓存
+class NullCache : public CacheEngine {
+ public:
+  std::vector<std::string> GetKeys() override { return {}; }
+  std::optional<Buffer> TryGet(const std::string& key) override { return std::nullopt; }
+  void Put(const std::string& key, std::string_view bytes, std::uint32_t cost_ms) override {}
+  void Purge() override {}
+  std::unique_ptr<EntryWriter> BeginPut(const std::string& key, std::uint32_t cost_ms) override { return nullptr; }
+};
+
+std::unique_ptr<CacheEngine> MakeL1Cache() {
+  if (FLAGS_l1_cache_engine == "memory") {
+    return std::make_unique<MemoryCache>(ParseMemorySize(FLAGS_l1_cache_size));
+  } else if (FLAGS_l1_cache_engine == "null") {
+    return std::make_unique<NullCache>();
+  }
+  LOG_FATAL("未知的L1缓存类型：`{}`", FLAGS_l1_cache_engine);
+}
+
+std::unique_ptr<CacheEngine> MakeL2Cache() {
+  if (FLAGS_l2_cache_engine == "disk") {
+    return std::make_unique<DiskCache>(FLAGS_disk_cache_dir, ParseMemorySize(FLAGS_l2_cache_size),
+                                       FLAGS_disk_cache_dedup);
+  } else if (FLAGS_l2_cache_engine == "null") {
+    return std::make_unique<NullCache>();
+  }
+  LOG_FATAL("未知的L2缓存类型：`{}`", FLAGS_l2_cache_engine);
+}
+
+} // namespace
+
 CacheServiceImpl::CacheServiceImpl()
   : purge_timer_(0, 1'000)
-  , bf_rebuild_timer_(0, 60'000) {
-  // TODO: 创建cache
+  , bf_snapshot_timer_(0, 60'000)
+  , dictionary_timer_(0, kTrainDictionaryIntervalMs)
+  , hot_keys_timer_(kDecayHotKeysIntervalMs, kDecayHotKeysIntervalMs)
+  , frequency_(kFrequencySketchKeys)
+  , hot_keys_(kHotKeysCapacity)
+  , dictionary_trainer_(FLAGS_dictionary_dir) {
+  L1_cache_ = MakeL1Cache();
+  L2_cache_ = MakeL2Cache();
+  max_pending_put_size_ = ParseMemorySize(FLAGS_max_pending_put_size);
+  if (!FLAGS_dictionary_server.empty()) {
+	dictionary_server_ = CacheService::NewStub(
+	  grpc::CreateChannel(FLAGS_dictionary_server, grpc::InsecureChannelCredentials()));
+  }
+  // 以启动时间作为初始版本，重启后客户端持有的旧版本不会被误认为有效
+  generation_ = pruned_generation_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::system_clock::now().time_since_epoch()).count();
+
+  // 引擎尚未Start，此时还没有读写与后台变更，先加载已有条目，之后由引擎通知变更
+  for (auto&& key : GetKeys()) {
+	++key_hashes_[Hash64(key)];
+  }
+  UnsafeRebuildBloomFilter();
+  auto observer = [this](const std::string& key, bool inserted) { OnEntryChanged(key, inserted); };
+  L1_cache_->SetObserver(observer);
+  L2_cache_->SetObserver(observer);
+  L1_cache_->Start();
+  L2_cache_->Start();
   user_token_verifier_ = MakeTokenVerifier(FLAGS_user_token);
   servant_token_verifier_ = MakeTokenVerifier(FLAGS_servant_token);
   purge_timer_.start(Poco::TimerCallback<CacheServiceImpl>(*this, &CacheServiceImpl::OnTimerPurge));
-  bf_rebuild_timer_.start(Poco::TimerCallback<CacheServiceImpl>(*this, &CacheServiceImpl::OnTimerRebuild));
+  bf_snapshot_timer_.start(Poco::TimerCallback<CacheServiceImpl>(*this, &CacheServiceImpl::OnTimerSnapshot));
+  dictionary_timer_.start(Poco::TimerCallback<CacheServiceImpl>(*this, &CacheServiceImpl::OnTimerTrainDictionary));
+  hot_keys_timer_.start(Poco::TimerCallback<CacheServiceImpl>(*this, &CacheServiceImpl::OnTimerDecayHotKeys));
 }
 
 grpc::Status CacheServiceImpl::TryGetEntry(grpc::ServerContext *context, 
@@ -28,24 +148,68 @@ grpc::Status CacheServiceImpl::TryGetEntry(grpc::ServerContext *context,
 	return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
   }
 
-  auto bytes = L1_cache_->TryGet(request->key());
+  auto bytes = TryGet(request->key());
   if (!bytes) {
-	bytes = L2_cache_->TryGet(request->key());
+	return grpc::Status(grpc::StatusCode::NOT_FOUND, "Cache miss");
   }
 
-  if (!bytes) {
-	cache_miss_.fetch_add(1, std::memory_order_relaxed);
-	return grpc::Status(grpc::StatusCode::NOT_FOUND, "Cache miss");
+  // 直接从Buffer（内存块或mmap的文件）切片发送，复用同一个chunk，
+  // Write阻塞直到流控允许，同一时刻只有一个分块在内存中
+  TryGetEntryResponseChunk chunk;
+  for (std::size_t i = 0; i < bytes->size(); i += FLAGS_chunk_size) {
+	auto slice = bytes->Slice(i, FLAGS_chunk_size);
+	chunk.set_file_chunk(slice.data(), slice.size());
+	if (!writer->Write(chunk)) {
+	  LOG_WARN("发送缓存`{}`中断", request->key());
+	  return grpc::Status(grpc::StatusCode::CANCELLED, "发送中断");
+	}
   }
 
-  cache_hits_.fetch_add(1, std::memory_order_relaxed);
-  L2_cache_->Put(request->key(), *bytes);
+  return grpc::Status::OK;
+}
 
-  for (std::size_t i = 0; i < bytes->size(); i += FLAGS_chunk_size) {
-	TryGetEntryResponseChunk chunk;
-	size_t remaining_size = bytes->size() - i;
-	chunk.set_file_chunk(bytes->data() + i, std::min(FLAGS_chunk_size, remaining_size));
-    writer->Write(chunk);
+grpc::Status CacheServiceImpl::TryGetEntries(grpc::ServerContext *context,
+  const TryGetEntriesRequest *request, grpc::ServerWriter<TryGetEntriesResponseChunk> *writer) {
+  LOG_DEBUG("调用者：`{}`，键数：{}", context->peer(), request->keys_size());
+
+  if (!user_token_verifier_->Verify(request->token())) {
+	return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
+  }
+  if (static_cast<std::uint32_t>(request->keys_size()) > FLAGS_max_batch_keys) {
+	return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "键数过多");
+  }
+
+  // 先查出所有键，未命中的随第一个响应告知，客户端无需等到流结束
+  std::vector<std::pair<std::uint32_t, Buffer>> hits;
+  TryGetEntriesResponseChunk chunk;
+  for (int i = 0; i < request->keys_size(); ++i) {
+	if (auto bytes = TryGet(request->keys(i), request->prefetch())) {
+	  hits.emplace_back(i, std::move(*bytes));
+	} else {
+	  chunk.add_missed_key_indices(i);
+	}
+  }
+
+  // 各命中的条目轮流发送一个分块，小条目不会排在大条目之后
+  for (std::size_t offset = 0; !hits.empty(); offset += FLAGS_chunk_size) {
+	for (auto iter = hits.begin(); iter != hits.end();) {
+	  auto&& [index, bytes] = *iter;
+	  auto slice = bytes.Slice(offset, FLAGS_chunk_size);
+	  chunk.set_key_index(index);
+	  chunk.set_file_chunk(slice.data(), slice.size());
+	  chunk.set_last_chunk(offset + FLAGS_chunk_size >= bytes.size());
+	  if (!writer->Write(chunk)) {
+		LOG_WARN("批量发送缓存中断");
+		return grpc::Status(grpc::StatusCode::CANCELLED, "发送中断");
+	  }
+	  chunk.clear_missed_key_indices();
+	  iter = chunk.last_chunk() ? hits.erase(iter) : std::next(iter);
+	}
+  }
+
+  // 全部未命中，只发送未命中列表
+  if (chunk.missed_key_indices_size()) {
+	writer->Write(chunk);
   }
 
   return grpc::Status::OK;
@@ -57,9 +221,15 @@ grpc::Status CacheServiceImpl::PutEntry(grpc::ServerContext *context,
 
   PutEntryRequestChunk chunk;
   std::unique_ptr<PutEntryRequest> request;
-  std::string file;
+  std::unique_ptr<EntryWriter> entry_writer;
+  std::size_t file_size = 0;
   bool is_first_chunk = true;
 
+  // 结束时归还占用的上传额度，未Commit的writer析构时丢弃数据
+  auto deffer = std::unique_ptr<void, std::function<void(void*)>>((void*)1, [&] (void*) {
+	pending_put_size_.fetch_sub(file_size, std::memory_order_relaxed);
+  });
+
   while (reader->Read(&chunk)) {
     if (is_first_chunk) [[unlikely]] {
 	  // 处理第一个块，请求
@@ -72,6 +242,19 @@ grpc::Status CacheServiceImpl::PutEntry(grpc::ServerContext *context,
         return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
       }
 
+	  auto engine = BeginPut(*request, &entry_writer);
+	  if (!engine) {
+		return grpc::Status(grpc::StatusCode::UNAVAILABLE, "缓存不可写入");
+	  }
+
+	  // 未通过准入则提前结束，客户端不必再上传
+	  RecordAccess(request->key());
+	  if (!Admit(engine, request->key())) {
+		LOG_DEBUG("缓存`{}`未通过准入", request->key());
+		response->set_admitted(false);
+		return grpc::Status::OK;
+	  }
+
 	  is_first_chunk = false;
 	} else [[likely]] {
 	  // 处理后续块，文件
@@ -79,27 +262,435 @@ grpc::Status CacheServiceImpl::PutEntry(grpc::ServerContext *context,
 		return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "rpc格式错误");
 	  }
 
-	  file.append(chunk.file_chunk().data(), chunk.file_chunk().size());
+	  auto size = chunk.file_chunk().size();
+	  if (pending_put_size_.fetch_add(size, std::memory_order_relaxed) + size > max_pending_put_size_) {
+		pending_put_size_.fetch_sub(size, std::memory_order_relaxed);
+		LOG_WARN("正在上传的缓存过多，拒绝写入`{}`", request->key());
+		return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "正在上传的缓存过多");
+	  }
+	  file_size += size;
+
+	  if (!entry_writer->Append(chunk.file_chunk())) {
+		return grpc::Status(grpc::StatusCode::INTERNAL, "写入缓存失败");
+	  }
 	}
   }
 
-  LOG_INFO("写入缓存: {}；大小：{}", request->key(), file.size());
-  L1_cache_->Put(request->key(), file);
-  L2_cache_->Put(request->key(), file);
-  bloom_filter_.Add(request->key());
+  if (!request) {
+	return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "rpc格式错误");
+  }
+  // 客户端取消或超时时Read同样返回false，条目可能不完整，不提交
+  if (context->IsCancelled()) {
+	return grpc::Status(grpc::StatusCode::CANCELLED, "上传中断");
+  }
+
+  if (!CommitPut(*request, entry_writer.get(), file_size)) {
+	return grpc::Status(grpc::StatusCode::INTERNAL, "写入缓存失败");
+  }
+  response->set_admitted(true);
 
   return grpc::Status::OK;
 }
 
+grpc::Status CacheServiceImpl::PutEntries(grpc::ServerContext *context,
+  grpc::ServerReader<PutEntryRequestChunk> *reader, PutEntriesResponse *response) {
+  LOG_DEBUG("调用者：`{}`", context->peer());
+
+  PutEntryRequestChunk chunk;
+  std::unique_ptr<PutEntryRequest> request;
+  std::unique_ptr<EntryWriter> entry_writer; // 为空时忽略当前条目的数据（未通过准入或写入失败）
+  std::uint32_t index = 0;
+  std::size_t file_size = 0; // 当前条目已接收的大小，占用上传额度直到条目结束
+
+  // 中途结束时归还当前条目占用的上传额度
+  auto deffer = std::unique_ptr<void, std::function<void(void*)>>((void*)1, [&] (void*) {
+	pending_put_size_.fetch_sub(file_size, std::memory_order_relaxed);
+  });
+
+  // 当前条目结束，提交写入，之后同一个流中的条目不再受它占用的额度限制
+  auto commit = [&] {
+	if (entry_writer && CommitPut(*request, entry_writer.get(), file_size)) {
+	  response->add_admitted_indices(index);
+	}
+	entry_writer.reset();
+	pending_put_size_.fetch_sub(file_size, std::memory_order_relaxed);
+	file_size = 0;
+  };
+
+  while (reader->Read(&chunk)) {
+	if (chunk.has_request()) {
+	  if (request) {
+		commit();
+		++index;
+	  }
+	  request.reset(chunk.release_request());
+	  if (!servant_token_verifier_->Verify(request->token())) {
+		return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
+	  }
+	  auto engine = BeginPut(*request, &entry_writer);
+	  RecordAccess(request->key());
+	  if (engine && !Admit(engine, request->key())) {
+		LOG_DEBUG("缓存`{}`未通过准入", request->key());
+		entry_writer.reset();
+	  }
+	} else {
+	  if (!request) [[unlikely]] {
+		return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "rpc格式错误");
+	  }
+	  if (!entry_writer) {
+		continue;
+	  }
+	  auto size = chunk.file_chunk().size();
+	  if (pending_put_size_.fetch_add(size, std::memory_order_relaxed) + size > max_pending_put_size_) {
+		pending_put_size_.fetch_sub(size, std::memory_order_relaxed);
+		LOG_WARN("正在上传的缓存过多，拒绝写入`{}`", request->key());
+		entry_writer.reset();
+		continue;
+	  }
+	  file_size += size;
+	  if (!entry_writer->Append(chunk.file_chunk())) {
+		entry_writer.reset();
+	  }
+	}
+  }
+  // 客户端取消或超时时Read同样返回false，最后一个条目可能不完整，丢弃
+  if (context->IsCancelled()) {
+	return grpc::Status(grpc::StatusCode::CANCELLED, "上传中断");
+  }
+  if (request) {
+	commit();
+  }
+
+  return grpc::Status::OK;
+}
+
+CacheEngine* CacheServiceImpl::BeginPut(const PutEntryRequest& request, std::unique_ptr<EntryWriter>* writer) {
+  // L1在读取命中L2时填充
+  for (auto&& e : {L2_cache_.get(), L1_cache_.get()}) {
+	if (*writer = e->BeginPut(request.key(), request.compile_cost_ms()); *writer) {
+	  return e;
+	}
+  }
+  return nullptr;
+}
+
+bool CacheServiceImpl::CommitPut(const PutEntryRequest& request, EntryWriter* writer, std::size_t size) {
+  if (!writer->Commit()) {
+	return false;
+  }
+  LOG_INFO("写入缓存: {}；大小：{}；编译耗时：{}ms", request.key(), size, request.compile_cost_ms());
+  dictionary_trainer_.OnEntryWritten(request.key());
+  TrackDictionaries(request.key(), true);
+  return true;
+}
+
+void CacheServiceImpl::TrackDictionaries(const std::string& key, bool replace) {
+  // 不计入命中，否则会改变淘汰顺序
+  auto bytes = L2_cache_->Peek(key);
+  if (!bytes) {
+	bytes = L1_cache_->Peek(key);
+  }
+  if (!bytes) {
+	return; // 已被淘汰
+  }
+  auto ids = GetDictionaryIds(bytes->View());
+  if (replace) {
+	for (auto id : ids) {
+	  if (!dictionary_trainer_.TryGet(id) && !SyncDictionary(id)) {
+		LOG_WARN("条目`{}`使用的字典{}不存在，daemon读取时将按未命中处理", key, id);
+	  }
+	}
+  }
+
+  // 在bf_mutex_下检查条目仍存在，之后的移除一定能看到这里的记录并释放引用
+  auto hash = Hash64(key);
+  std::scoped_lock lock(bf_mutex_);
+  if (!key_hashes_.count(hash)) {
+	return;
+  }
+  auto iter = entry_dictionaries_.find(hash);
+  if (iter != entry_dictionaries_.end()) {
+	if (!replace) {
+	  return;
+	}
+	dictionary_trainer_.ReleaseRefs(iter->second);
+	entry_dictionaries_.erase(iter);
+  }
+  if (!ids.empty()) {
+	dictionary_trainer_.AddRefs(ids);
+	entry_dictionaries_.emplace(hash, std::move(ids));
+  }
+}
+
+void CacheServiceImpl::LoadDictionaryRefs() {
+  for (auto&& key : GetKeys()) {
+	TrackDictionaries(key, false);
+  }
+  std::size_t entries;
+  {
+	std::scoped_lock lock(bf_mutex_);
+	entries = entry_dictionaries_.size();
+  }
+  dictionary_trainer_.OnRefsLoaded();
+  LOG_INFO("{} 个已有条目使用了字典", entries);
+}
+
+bool CacheServiceImpl::SyncDictionary(std::uint32_t id) {
+  if (!dictionary_server_) {
+	return false;
+  }
+  grpc::ClientContext context;
+  FetchDictionaryRequest req;
+  FetchDictionaryResponse resp;
+  SetTimeout(&context, 10s);
+  req.set_token(FLAGS_dictionary_server_token);
+  req.set_dictionary_id(id);
+  auto status = dictionary_server_->FetchDictionary(&context, req, &resp);
+  if (!status.ok()) {
+	if (status.error_code() != grpc::StatusCode::NOT_FOUND) {
+	  LOG_WARN("向`{}`获取字典{}失败：{}", FLAGS_dictionary_server, id, status.error_message());
+	}
+	return false;
+  }
+  auto dict = ZSTDDictionary::Create(std::move(*resp.mutable_dictionary()));
+  if (!dict || (id && dict->GetId() != id)) {
+	LOG_WARN("无法解析字典{}", resp.dictionary_id());
+	return false;
+  }
+  dictionary_trainer_.Add(std::move(dict), id == 0);
+  return true;
+}
+
 grpc::Status CacheServiceImpl::FetchBloomFilter(grpc::ServerContext *context,
   const FetchBloomFilterRequest *request, FetchBloomFilterResponse *response) {
-  // TODO:
-  return grpc::Status();
+  LOG_DEBUG("调用者：`{}`", context->peer());
+
+  if (!user_token_verifier_->Verify(request->token())) {
+	return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
+  }
+
+  auto secs_last_full_fetch = std::chrono::seconds(request->secs_last_full_fetch());
+
+  std::scoped_lock lock(bf_mutex_);
+  if (bf_snapshot_.empty()) {
+	return grpc::Status(grpc::StatusCode::UNAVAILABLE, "布隆过滤器尚未构建");
+  }
+
+  auto generation = request->generation();
+  if (secs_last_full_fetch < kFullFetchInterval &&
+      generation >= pruned_generation_ && generation <= generation_) {
+	// 增量更新，只返回客户端版本之后的变更
+	response->set_incremental(true);
+	AddChangesSince(changes_.begin(), changes_.end(), generation, response);
+  } else {
+	// 全量更新，返回定时序列化好的快照及其之后的变更
+	response->set_incremental(false);
+	response->set_bloom_filter(bf_snapshot_);
+	AddChangesSince(changes_.begin(), changes_.end(), bf_snapshot_generation_, response);
+  }
+  response->set_generation(generation_);
+
+  return grpc::Status::OK;
+}
+
+grpc::Status CacheServiceImpl::FetchDictionary(grpc::ServerContext* context,
+  const FetchDictionaryRequest* request, FetchDictionaryResponse* response) {
+  LOG_DEBUG("调用者：`{}`", context->peer());
+
+  // local读取时解压、servant写入时压缩都需要字典
+  if (!user_token_verifier_->Verify(request->token()) &&
+      !servant_token_verifier_->Verify(request->token())) {
+	return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
+  }
+
+  auto dict = request->dictionary_id() ? dictionary_trainer_.TryGet(request->dictionary_id())
+                                       : dictionary_trainer_.GetLatest();
+  if (!dict) {
+	return grpc::Status(grpc::StatusCode::NOT_FOUND, "字典不存在");
+  }
+  response->set_dictionary_id(dict->GetId());
+  response->set_dictionary(dict->GetBytes());
+  return grpc::Status::OK;
+}
+
+grpc::Status CacheServiceImpl::FetchHotKeys(grpc::ServerContext* context,
+  const FetchHotKeysRequest* request, FetchHotKeysResponse* response) {
+  LOG_DEBUG("调用者：`{}`", context->peer());
+
+  if (!user_token_verifier_->Verify(request->token()) &&
+      !servant_token_verifier_->Verify(request->token())) {
+	return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
+  }
+
+  std::vector<std::pair<std::string, std::uint64_t>> top;
+  {
+	std::scoped_lock lock(hot_keys_mutex_);
+	top = hot_keys_.GetTop(std::min<std::size_t>(request->max_keys(), kMaxHotKeys));
+  }
+  for (auto&& [key, hits] : top) {
+	auto* hot_key = response->add_keys();
+	hot_key->set_key(key);
+	hot_key->set_hits(hits);
+  }
+  return grpc::Status::OK;
 }
 
 void CacheServiceImpl::Stop() {
   purge_timer_.stop();
-  bf_rebuild_timer_.stop();
+  bf_snapshot_timer_.stop();
+  dictionary_timer_.stop();
+  hot_keys_timer_.stop();
+}
+
+void CacheServiceImpl::OnTimerTrainDictionary(Poco::Timer& timer) {
+  // 第一次执行时统计已有条目引用的字典，不阻塞启动
+  if (!dictionary_refs_loaded_) {
+	LoadDictionaryRefs();
+	dictionary_refs_loaded_ = true;
+  }
+
+  // 所有节点使用同一个节点训练的字典，servant压缩的条目落在哪个分片都能找到字典
+  if (dictionary_server_) {
+	SyncDictionary(0);
+  } else {
+	// 直接读取引擎，不计入访问频率
+	dictionary_trainer_.Train([this](const std::string& key) {
+	  auto bytes = L1_cache_->TryGet(key);
+	  return bytes ? bytes : L2_cache_->TryGet(key);
+	});
+  }
+  dictionary_trainer_.RemoveUnreferenced();
+}
+
+void CacheServiceImpl::OnTimerDecayHotKeys(Poco::Timer& timer) {
+  std::scoped_lock lock(hot_keys_mutex_);
+  hot_keys_.Decay();
+}
+
+void CacheServiceImpl::OnTimerSnapshot(Poco::Timer& timer) {
+  CountingBloomFilter bloom_filter;
+  std::uint64_t generation;
+  {
+	std::scoped_lock lock(bf_mutex_);
+	if (key_hashes_.size() > bf_capacity_) {
+	  UnsafeRebuildBloomFilter(); // 条目数超出容量，误判率上升，扩容
+	}
+	bloom_filter = bloom_filter_;
+	generation = generation_;
+  }
+
+  // 在锁外序列化
+  auto snapshot = bloom_filter.Serialize();
+  if (snapshot.empty()) {
+	LOG_WARN("序列化布隆过滤器失败");
+	return;
+  }
+
+  std::scoped_lock lock(bf_mutex_);
+  bf_snapshot_ = std::move(snapshot);
+  bf_snapshot_generation_ = generation;
+
+  // 快照之后的变更在全量更新时仍需要，不能丢弃
+  auto expired = std::chrono::steady_clock::now() - kChangesWindow;
+  while (!changes_.empty() && changes_.front().time < expired &&
+         changes_.front().generation <= bf_snapshot_generation_) {
+	pruned_generation_ = changes_.front().generation;
+	changes_.pop_front();
+  }
+  LOG_DEBUG("布隆过滤器快照：{} 个key，序列化后 {} 字节", key_hashes_.size(), bf_snapshot_.size());
+}
+
+void CacheServiceImpl::OnEntryChanged(const std::string& key, bool inserted) {
+  auto hash = Hash64(key);
+  bool evicted = false; // 已不在任何一级缓存中
+  {
+	// 只有key出现在第一级缓存或从最后一级缓存消失时才改变布隆过滤器，
+	// L2命中提升到L1、L1淘汰已在L2中的条目都不产生变更
+	std::scoped_lock lock(bf_mutex_);
+	if (inserted) {
+	  if (++key_hashes_[hash] != 1) {
+		return;
+	  }
+	  bloom_filter_.AddHash(hash);
+	} else {
+	  auto iter = key_hashes_.find(hash);
+	  if (iter == key_hashes_.end() || --iter->second != 0) {
+		return;
+	  }
+	  key_hashes_.erase(iter);
+	  evicted = true;
+	  bloom_filter_.RemoveHash(hash);
+	  if (auto refs = entry_dictionaries_.find(hash); refs != entry_dictionaries_.end()) {
+		dictionary_trainer_.ReleaseRefs(refs->second);
+		entry_dictionaries_.erase(refs);
+	  }
+	}
+	changes_.push_back(Change{
+	  .generation = ++generation_,
+	  .hash       = hash,
+	  .removed    = !inserted,
+	  .time       = std::chrono::steady_clock::now(),
+	});
+  }
+
+  if (evicted) {
+	std::scoped_lock lock(hot_keys_mutex_);
+	hot_keys_.Remove(key);
+  }
+}
+
+void CacheServiceImpl::UnsafeRebuildBloomFilter() {
+  // 预留一倍空间给之后写入的key
+  bf_capacity_ = std::max(key_hashes_.size() * 2, kMinBloomFilterKeys);
+  bloom_filter_ = CountingBloomFilter::ForCapacity(bf_capacity_);
+  for (auto&& [hash, _] : key_hashes_) {
+	bloom_filter_.AddHash(hash);
+  }
+  LOG_INFO("重建布隆过滤器：{} 个key，容量 {}", key_hashes_.size(), bf_capacity_);
+}
+
+std::optional<Buffer> CacheServiceImpl::TryGet(const std::string& key, bool prefetch) {
+  if (prefetch) {
+	// 预取的是已经热门的key，计入会使热点自我强化
+	auto bytes = L1_cache_->TryGet(key);
+	return bytes ? bytes : L2_cache_->TryGet(key);
+  }
+
+  auto accesses = RecordAccess(key);
+  auto bytes = L1_cache_->TryGet(key);
+  if (!bytes) {
+	bytes = L2_cache_->TryGet(key);
+	if (bytes && accesses >= kMinPromoteAccesses) {
+	  L1_cache_->Put(key, bytes->View(), 0); // 反复命中的条目提升到L1，L1不使用编译耗时
+	}
+  }
+
+  if (bytes) {
+	cache_hits_.fetch_add(1, std::memory_order_relaxed);
+	std::scoped_lock lock(hot_keys_mutex_);
+	hot_keys_.Hit(key);
+  } else {
+	cache_miss_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return bytes;
+}
+
+std::uint32_t CacheServiceImpl::RecordAccess(const std::string& key) {
+  auto hash = Hash64(key);
+  std::scoped_lock lock(frequency_mutex_);
+  frequency_.Increment(hash);
+  return frequency_.Estimate(hash);
+}
+
+bool CacheServiceImpl::Admit(CacheEngine* engine, const std::string& key) {
+  auto victim = engine->GetEvictionCandidate(key);
+  if (!victim) {
+	return true; // 空间充足
+  }
+  auto hash = Hash64(key);
+  auto victim_hash = Hash64(*victim);
+  std::scoped_lock lock(frequency_mutex_);
+  return frequency_.Estimate(hash) > frequency_.Estimate(victim_hash);
 }
 
 std::vector<std::string> CacheServiceImpl::GetKeys() const {
@@ -1,8 +1,15 @@
 #pragma once
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 #include <Poco/Timer.h>
 #include "common/token_verifier.h"
+#include "common/bloom_filter.h"
 #include "cache/cache_engine.h"
-#include "cache/bloom_filter.h"
+#include "cache/dictionary_trainer.h"
+#include "cache/frequency_sketch.h"
+#include "cache/hot_keys.h"
 #include "../build/distribuild/proto/cache.grpc.pb.h"
 
 namespace distribuild::cache {
@@ -15,32 +22,114 @@ class CacheServiceImpl : public CacheService::Service {
   grpc::Status TryGetEntry(grpc::ServerContext* context, const TryGetEntryRequest* request,
                            grpc::ServerWriter<TryGetEntryResponseChunk>* writer) override;
 
+  // 批量获得缓存
+  grpc::Status TryGetEntries(grpc::ServerContext* context, const TryGetEntriesRequest* request,
+                             grpc::ServerWriter<TryGetEntriesResponseChunk>* writer) override;
+
   // 获得缓存
   grpc::Status PutEntry(grpc::ServerContext* context, grpc::ServerReader<PutEntryRequestChunk>* reader, 
                         PutEntryResponse* response) override;
 
+  // 批量写入缓存
+  grpc::Status PutEntries(grpc::ServerContext* context, grpc::ServerReader<PutEntryRequestChunk>* reader,
+                          PutEntriesResponse* response) override;
+
   // 向缓存服务器请求布隆过滤器内容
   grpc::Status FetchBloomFilter(grpc::ServerContext* context, const FetchBloomFilterRequest* request,
                                 FetchBloomFilterResponse* response) override;
 
+  // 获取zstd字典
+  grpc::Status FetchDictionary(grpc::ServerContext* context, const FetchDictionaryRequest* request,
+                               FetchDictionaryResponse* response) override;
+
+  // 获取近期命中最多的key
+  grpc::Status FetchHotKeys(grpc::ServerContext* context, const FetchHotKeysRequest* request,
+                            FetchHotKeysResponse* response) override;
+
   void Stop();
  
  private:
   std::vector<std::string> GetKeys() const;
-  void OnTimerPurge(Poco::Timer& timer) { L1_cache_->Purge(); }
-  void OnTimerRebuild(Poco::Timer& timer) { auto keys = GetKeys(); }
+
+  /// @brief 依次查找L1、L2，L2命中且近期反复访问则提升到L1
+  /// @param prefetch 预取，只读取，不记录访问
+  std::optional<Buffer> TryGet(const std::string& key, bool prefetch = false);
+
+  /// @brief 开始写入：优先直接写入L2（磁盘），L2不接受时才写L1，返回写入的引擎，都不可写入时返回空
+  CacheEngine* BeginPut(const PutEntryRequest& request, std::unique_ptr<EntryWriter>* writer);
+
+  /// @brief 提交写入的条目
+  bool CommitPut(const PutEntryRequest& request, EntryWriter* writer, std::size_t size);
+
+  /// @brief 记录条目引用的字典，本节点没有的字典向训练字典的节点获取
+  /// @param replace 已有记录时是否替换，写入条目时替换，启动时统计已有条目时不替换
+  void TrackDictionaries(const std::string& key, bool replace);
+
+  /// @brief 统计启动时已有条目引用的字典，完成前不删除字典
+  void LoadDictionaryRefs();
+
+  /// @brief 向训练字典的节点获取字典，id为0时获取最新的字典；本节点训练字典时返回false
+  bool SyncDictionary(std::uint32_t id);
+
+  /// @brief 记录一次访问（读取或写入），返回近期访问次数的估计
+  std::uint32_t RecordAccess(const std::string& key);
+
+  /// @brief 准入：引擎空间将满时，只有比将被淘汰的条目访问更频繁的key才写入
+  bool Admit(CacheEngine* engine, const std::string& key);
+  void OnTimerPurge(Poco::Timer& timer) { L1_cache_->Purge(); L2_cache_->Purge(); }
+  void OnTimerSnapshot(Poco::Timer& timer);
+  void OnTimerTrainDictionary(Poco::Timer& timer);
+  void OnTimerDecayHotKeys(Poco::Timer& timer);
+
+  /// @brief 缓存引擎加入或移出条目时更新布隆过滤器
+  void OnEntryChanged(const std::string& key, bool inserted);
+
+  /// @brief 按当前条目数重新分配布隆过滤器，需持有bf_mutex_
+  void UnsafeRebuildBloomFilter();
 
  private:
   Poco::Timer purge_timer_;
-  Poco::Timer bf_rebuild_timer_;
+  Poco::Timer bf_snapshot_timer_;
+  Poco::Timer dictionary_timer_;
+  Poco::Timer hot_keys_timer_;
   std::unique_ptr<TokenVerifier> user_token_verifier_;
   std::unique_ptr<TokenVerifier> servant_token_verifier_;
   std::atomic<std::uint64_t> cache_miss_{};
   std::atomic<std::uint64_t> cache_hits_{};
+  std::size_t max_pending_put_size_;             // 上传中条目总大小上限
+  std::atomic<std::size_t> pending_put_size_{};  // 上传中、尚未发布的条目总大小
 
   std::unique_ptr<CacheEngine> L1_cache_; // L1 cache
   std::unique_ptr<CacheEngine> L2_cache_; // L2 cache
-  BloomFilter bloom_filter_;
+
+  std::mutex frequency_mutex_;
+  FrequencySketch frequency_;             // 近期访问频率，用于准入
+
+  std::mutex hot_keys_mutex_;
+  HotKeys hot_keys_;                      // 近期命中最多的key，供daemon预取
+
+  DictionaryTrainer dictionary_trainer_;  // 从写入的条目中采样训练zstd字典
+  std::unique_ptr<CacheService::Stub> dictionary_server_; // 训练字典的节点，为空时由本节点训练
+  bool dictionary_refs_loaded_ = false;   // 只在定时器线程访问
+
+  /// @brief 条目的加入或移出
+  struct Change {
+    std::uint64_t generation;
+    std::uint64_t hash;
+    bool removed;
+    std::chrono::steady_clock::time_point time;
+  };
+
+  std::mutex bf_mutex_;
+  CountingBloomFilter bloom_filter_;          // 所有缓存条目，每个key哈希只计一次，随写入与淘汰增量更新
+  std::size_t bf_capacity_ = 0;               // bloom_filter_按多少个条目分配
+  std::unordered_map<std::uint64_t, std::uint32_t> key_hashes_; // 每个key哈希在各级缓存中的条目数，扩容时用于重建
+  std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> entry_dictionaries_; // key哈希 -> 条目引用的字典，只记录使用字典的条目
+  std::string bf_snapshot_;                   // 定时序列化的布隆过滤器
+  std::uint64_t bf_snapshot_generation_ = 0;  // bf_snapshot_包含的最大版本
+  std::uint64_t generation_;                  // 每加入或移出一个条目加一
+  std::uint64_t pruned_generation_;           // 已丢弃的变更的最大版本
+  std::deque<Change> changes_;                // 按版本递增，用于增量更新
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include <array>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache/chunk_store.h"
+#include "common/crypto/blake3.h"
+#include "common/encode.h"
+#include "common/spdlogging.h"
+#include "common/dir.h"
+#include "common/io.h"
+
+namespace distribuild::cache {
+
+namespace {
+
+constexpr std::string_view kManifestMagic = "DCCM";
+constexpr std::size_t kIdSize = 16;
+
+/// @brief 清单头部，之后是ManifestChunk列表
+struct ManifestHeader {
+  char magic[4];
+  std::uint64_t size;  // 条目大小
+} __attribute__((packed));
+
+struct ManifestChunk {
+  char id[kIdSize];
+  std::uint32_t size;
+} __attribute__((packed));
+
+// gear哈希：每个字节左移一位后加上该字节的随机数，高位由最近64个字节决定
+constexpr auto kGear = [] {
+  std::array<std::uint64_t, 256> result{};
+  std::uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (auto&& e : result) {
+    // splitmix64，表在不同进程、不同版本间保持一致，相同内容总是切出相同的块
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    e = z ^ (z >> 31);
+  }
+  return result;
+}();
+
+// 归一化分块：未到平均大小时用更多的位判断，之后用更少的位，块大小集中在平均值附近
+constexpr std::uint64_t kMaskS = ~0ULL << (64 - 16);
+constexpr std::uint64_t kMaskL = ~0ULL << (64 - 12);
+
+} // namespace
+
+ChunkStore::Writer::~Writer() {
+  if (!finished_) {
+    // 未完成的条目，释放已写入的块
+    ManifestHeader header{.size = 0};
+    memcpy(header.magic, kManifestMagic.data(), sizeof(header.magic));
+    store_->Release(std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + manifest_);
+  }
+}
+
+bool ChunkStore::Writer::Append(std::string_view bytes) {
+  pending_.append(bytes);
+  return Flush(false);
+}
+
+std::optional<std::string> ChunkStore::Writer::Finish() {
+  if (!Flush(true)) {
+    return std::nullopt;
+  }
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < manifest_.size(); i += sizeof(ManifestChunk)) {
+    ManifestChunk chunk;
+    memcpy(&chunk, manifest_.data() + i, sizeof(chunk));
+    size += chunk.size;
+  }
+  ManifestHeader header{.size = size};
+  memcpy(header.magic, kManifestMagic.data(), sizeof(header.magic));
+  finished_ = true;
+  return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + manifest_;
+}
+
+bool ChunkStore::Writer::Flush(bool final) {
+  std::string_view data(pending_);
+  std::size_t offset = 0;
+  while (offset < data.size()) {
+    auto length = FindBoundary(data.substr(offset), &scanned_, &hash_);
+    if (length == 0) {
+      if (!final) {
+        break;
+      }
+      length = data.size() - offset;
+    }
+    auto id = store_->Put(data.substr(offset, length));
+    if (!id) {
+      return false;
+    }
+    ManifestChunk chunk{.size = static_cast<std::uint32_t>(length)};
+    memcpy(chunk.id, id->data(), kIdSize);
+    manifest_.append(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+    offset += length;
+    scanned_ = 0;
+    hash_ = 0;
+  }
+  pending_.erase(0, offset);
+  return true;
+}
+
+ChunkStore::ChunkStore(std::string dir, std::string temp_dir)
+  : dir_(std::move(dir)), temp_dir_(std::move(temp_dir)) {
+  Mkdirs(dir_);
+  // 引用计数由之后的AddRefs重建
+  for (auto&& node : GetDirNodesRecursively(dir_)) {
+    if (!node.is_regular) {
+      continue;
+    }
+    auto path = fmt::format("{}/{}", dir_, node.name);
+    struct stat buf;
+    if (stat(path.c_str(), &buf) != 0) {
+      continue;
+    }
+    auto id = node.name.substr(node.name.find_last_of('/') + 1);
+    if (id.size() != kIdSize * 2 || path != GetPath(id)) {
+      LOG_WARN("删除无法识别的块文件`{}`", path);
+      unlink(path.c_str());
+      continue;
+    }
+    chunks_[id].size = buf.st_size;
+    size_ += buf.st_size;
+  }
+}
+
+std::optional<std::size_t> ChunkStore::GetEntrySize(std::string_view manifest) {
+  ManifestHeader header;
+  if (manifest.size() < sizeof(header) || manifest.substr(0, kManifestMagic.size()) != kManifestMagic) {
+    return std::nullopt;
+  }
+  memcpy(&header, manifest.data(), sizeof(header));
+  return static_cast<std::size_t>(header.size);
+}
+
+std::optional<Buffer> ChunkStore::Read(std::string_view manifest) {
+  auto size = GetEntrySize(manifest);
+  auto chunks = ParseManifest(manifest);
+  if (!size || !chunks) {
+    return std::nullopt;
+  }
+  std::string result;
+  result.reserve(*size);
+  for (auto&& [id, chunk_size] : *chunks) {
+    auto bytes = ReadFile(GetPath(EncodeHex(id)), chunk_size);
+    if (!bytes) {
+      return std::nullopt; // 块已被删除，按未命中处理
+    }
+    result.append(*bytes);
+  }
+  return Buffer(std::move(result));
+}
+
+bool ChunkStore::AddRefs(std::string_view manifest) {
+  auto chunks = ParseManifest(manifest);
+  if (!chunks) {
+    return false;
+  }
+  std::scoped_lock lock(mutex_);
+  for (auto&& [id, _] : *chunks) {
+    ++chunks_[EncodeHex(id)].refs; // 块文件丢失时读取失败，按未命中处理
+  }
+  return true;
+}
+
+void ChunkStore::Release(std::string_view manifest) {
+  if (auto chunks = ParseManifest(manifest)) {
+    for (auto&& [id, _] : *chunks) {
+      ReleaseChunk(EncodeHex(id));
+    }
+  }
+}
+
+void ChunkStore::RemoveUnreferenced() {
+  std::size_t removed = 0;
+  std::scoped_lock lock(mutex_);
+  for (auto iter = chunks_.begin(); iter != chunks_.end();) {
+    if (iter->second.refs) {
+      ++iter;
+      continue;
+    }
+    unlink(GetPath(iter->first).c_str());
+    size_ -= iter->second.size;
+    iter = chunks_.erase(iter);
+    ++removed;
+  }
+  LOG_INFO("块存储：{} 个块共 {} 字节，删除了 {} 个未被引用的块", chunks_.size(), GetSize(), removed);
+}
+
+std::size_t ChunkStore::FindBoundary(std::string_view data, std::size_t* scanned, std::uint64_t* hash) {
+  auto end = std::min(data.size(), kMaxChunkSize);
+  auto h = *hash;
+  // 最小块长度之内不会切分，不需要计算哈希
+  for (auto i = std::max(*scanned, kMinChunkSize); i < end; ++i) {
+    h = (h << 1) + kGear[static_cast<std::uint8_t>(data[i])];
+    if (!(h & (i < kAvgChunkSize ? kMaskS : kMaskL))) {
+      return i + 1;
+    }
+  }
+  if (end == kMaxChunkSize) {
+    return kMaxChunkSize;
+  }
+  *scanned = std::max(end, *scanned);
+  *hash = h;
+  return 0;
+}
+
+std::optional<std::vector<std::pair<std::string_view, std::uint32_t>>> ChunkStore::ParseManifest(std::string_view manifest) {
+  if (!GetEntrySize(manifest) || (manifest.size() - sizeof(ManifestHeader)) % sizeof(ManifestChunk)) {
+    return std::nullopt;
+  }
+  std::vector<std::pair<std::string_view, std::uint32_t>> result;
+  for (auto i = sizeof(ManifestHeader); i < manifest.size(); i += sizeof(ManifestChunk)) {
+    ManifestChunk chunk;
+    memcpy(&chunk, manifest.data() + i, sizeof(chunk));
+    result.emplace_back(manifest.substr(i + offsetof(ManifestChunk, id), kIdSize), static_cast<std::uint32_t>(chunk.size));
+  }
+  return result;
+}
+
+std::optional<std::string> ChunkStore::Put(std::string_view chunk) {
+  auto id = Blake3(chunk).substr(0, kIdSize);
+  auto hex = EncodeHex(id);
+  {
+    std::scoped_lock lock(mutex_);
+    if (auto iter = chunks_.find(hex); iter != chunks_.end()) {
+      ++iter->second.refs;
+      return id;
+    }
+  }
+
+  // 新块，在锁外写临时文件
+  auto temp_path = fmt::format("{}/chunk.{}", temp_dir_, next_temp_id_.fetch_add(1, std::memory_order_relaxed));
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG_WARN("创建临时文件`{}`失败", temp_path);
+    return std::nullopt;
+  }
+  std::size_t written = 0;
+  while (written < chunk.size()) {
+    auto result = WriteTo(fd, chunk, written);
+    if (result <= 0) {
+      break;
+    }
+    written += result;
+  }
+  close(fd);
+  if (written != chunk.size()) {
+    LOG_WARN("写入临时文件`{}`失败", temp_path);
+    unlink(temp_path.c_str());
+    return std::nullopt;
+  }
+
+  auto path = GetPath(hex);
+  std::scoped_lock lock(mutex_);
+  if (auto iter = chunks_.find(hex); iter != chunks_.end()) {
+    // 其他写入者同时存入了相同的块
+    ++iter->second.refs;
+    unlink(temp_path.c_str());
+    return id;
+  }
+  Mkdirs(path.substr(0, path.find_last_of('/')));
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG_WARN("重命名块文件`{}`失败", temp_path);
+    unlink(temp_path.c_str());
+    return std::nullopt;
+  }
+  chunks_[hex] = Chunk{.size = static_cast<std::uint32_t>(chunk.size()), .refs = 1};
+  size_ += chunk.size();
+  return id;
+}
+
+void ChunkStore::ReleaseChunk(std::string_view id) {
+  std::scoped_lock lock(mutex_);
+  auto iter = chunks_.find(std::string(id));
+  if (iter == chunks_.end() || (iter->second.refs && --iter->second.refs)) {
+    return;
+  }
+  unlink(GetPath(id).c_str());
+  size_ -= iter->second.size;
+  chunks_.erase(iter);
+}
+
+std::string ChunkStore::GetPath(std::string_view id) const {
+  return fmt::format("{}/{}/{}", dir_, id.substr(0, 2), id);
+}
+
+} // namespace distribuild::cache
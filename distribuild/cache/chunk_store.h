@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "cache/buffer.h"
+
+namespace distribuild::cache {
+
+/// @brief 磁盘缓存的去重层，条目按内容定义分块（FastCDC，gear哈希），相同内容的块只存一份
+/// 块存放在`{dir}/xx/{块ID}`，块ID为内容Blake3的前16字节；条目文件只保存清单（块ID与大小的列表）。
+/// 引用计数只在内存中：每个清单文件对其中的块各持有一个引用，启动时扫描清单重建，
+/// 删除或覆盖清单文件的一方负责Release
+class ChunkStore {
+ public:
+  static constexpr std::size_t kMinChunkSize = 4 << 10;
+  static constexpr std::size_t kAvgChunkSize = 16 << 10;
+  static constexpr std::size_t kMaxChunkSize = 64 << 10;
+
+  /// @brief 分块写入一个条目，Finish前析构则释放已写入的块
+  class Writer {
+   public:
+    explicit Writer(ChunkStore* store) : store_(store) {}
+    ~Writer();
+
+    bool Append(std::string_view bytes);
+
+    /// @brief 写入剩余数据，返回清单，清单持有所有块的引用
+    std::optional<std::string> Finish();
+
+   private:
+    /// @brief 切出pending_中所有完整的块，final为true时剩余数据也作为一块
+    bool Flush(bool final);
+
+    ChunkStore* store_;
+    std::string pending_;         // 尚未切分的数据
+    std::size_t scanned_ = 0;     // pending_中已计算过哈希的长度
+    std::uint64_t hash_ = 0;      // gear哈希
+    std::string manifest_;
+    bool finished_ = false;
+  };
+
+  /// @param dir 块目录
+  /// @param temp_dir 写块时使用的临时目录
+  ChunkStore(std::string dir, std::string temp_dir);
+
+  /// @brief 所有块的总大小
+  std::size_t GetSize() const noexcept { return size_.load(std::memory_order_relaxed); }
+
+  /// @brief 清单中记录的条目大小，不是清单时返回空
+  static std::optional<std::size_t> GetEntrySize(std::string_view manifest);
+
+  /// @brief 按清单拼接条目
+  std::optional<Buffer> Read(std::string_view manifest);
+
+  /// @brief 启动时为扫描到的清单增加引用，不是清单时返回false
+  bool AddRefs(std::string_view manifest);
+
+  /// @brief 释放清单持有的引用，引用为0的块被删除
+  void Release(std::string_view manifest);
+
+  /// @brief 删除没有被引用的块（启动时重建引用后调用）
+  void RemoveUnreferenced();
+
+ private:
+  struct Chunk {
+    std::uint32_t size = 0;
+    std::uint32_t refs = 0;
+  };
+
+  /// @brief 寻找块的结尾，返回块长度；数据不足以确定时返回0
+  static std::size_t FindBoundary(std::string_view data, std::size_t* scanned, std::uint64_t* hash);
+
+  /// @brief 解析清单中的块ID与大小
+  static std::optional<std::vector<std::pair<std::string_view, std::uint32_t>>> ParseManifest(std::string_view manifest);
+
+  /// @brief 存入一个块（已存在则只增加引用），返回块ID
+  /// 新块先写临时文件，在锁内rename，与删除互斥
+  std::optional<std::string> Put(std::string_view chunk);
+
+  /// @brief 释放一个块的引用
+  void ReleaseChunk(std::string_view id);
+
+  std::string GetPath(std::string_view id) const;
+
+ private:
+  const std::string dir_;
+  const std::string temp_dir_;
+  std::atomic<std::uint64_t> next_temp_id_{};
+  std::atomic<std::size_t> size_{};
+
+  std::mutex mutex_;  // 块文件的删除与新建也在锁内决定，避免删除正被引用的块
+  std::unordered_map<std::string, Chunk> chunks_;
+};
+
+} // namespace distribuild::cache
@@ -0,0 +1,223 @@
+#include <fstream>
+#include <unistd.h>
+#include "cache/dictionary_trainer.h"
+#include "common/cache_format.h"
+#include "common/dir.h"
+#include "common/io.h"
+#include "common/spdlogging.h"
+#include "common/tools.h"
+
+namespace distribuild::cache {
+
+namespace {
+
+constexpr std::string_view kFilePrefix = "dict-";
+
+} // namespace
+
+DictionaryTrainer::DictionaryTrainer(std::string dir)
+  : dir_(std::move(dir)) {
+  Load();
+}
+
+void DictionaryTrainer::OnEntryWritten(const std::string& key) {
+  std::scoped_lock lock(mutex_);
+  if (written_++ % kSampleInterval != 0) {
+    return;
+  }
+  sample_keys_.push_back(key);
+  if (sample_keys_.size() > kMaxSampleKeys) {
+    sample_keys_.pop_front();
+  }
+}
+
+void DictionaryTrainer::Train(const std::function<std::optional<Buffer>(const std::string& key)>& read) {
+  std::deque<std::string> keys;
+  {
+    std::scoped_lock lock(mutex_);
+    keys = sample_keys_;
+  }
+
+  // 解压条目中的文件作为样本，使用未知字典的文件跳过
+  std::vector<std::string> samples;
+  std::size_t sample_bytes = 0;
+  for (auto iter = keys.rbegin(); iter != keys.rend() && sample_bytes < kMaxSampleBytes; ++iter) {
+    auto bytes = read(*iter);
+    if (!bytes) {
+      continue;
+    }
+    auto entry = TryParseCacheEntryView(bytes->View());
+    if (!entry) {
+      continue;
+    }
+    for (auto&& [_, content] : entry->files) {
+      auto size = ZSTD_getFrameContentSize(content.data(), content.size());
+      if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > kMaxSampleFileSize) {
+        continue;
+      }
+      std::shared_ptr<const ZSTDDictionary> dict;
+      if (auto id = ZSTDGetDictId(content); id && !(dict = TryGet(id))) {
+        continue;
+      }
+      if (auto decompressed = ZSTDDecompress(content, dict.get())) {
+        sample_bytes += decompressed->size();
+        samples.push_back(std::move(*decompressed));
+      }
+    }
+  }
+  if (samples.size() < kMinSamples) {
+    LOG_DEBUG("字典样本不足：{} 个文件", samples.size());
+    return;
+  }
+
+  auto bytes = ZSTDTrainDictionary(samples, kDictionarySize);
+  if (!bytes) {
+    LOG_WARN("训练字典失败，样本：{} 个文件，{} 字节", samples.size(), sample_bytes);
+    return;
+  }
+  auto dict = ZSTDDictionary::Create(std::move(*bytes));
+  if (!dict) {
+    LOG_WARN("训练得到的字典无效");
+    return;
+  }
+
+  std::scoped_lock lock(mutex_);
+  if (UnsafeFind(dict->GetId())) {
+    return; // 样本没有变化
+  }
+  auto seq = next_seq_++;
+  dictionaries_.emplace(seq, dict);
+  latest_ = dict;
+  UnsafeSave(seq, *dict);
+  LOG_INFO("训练字典{}：{} 字节，样本：{} 个文件，{} 字节", dict->GetId(), dict->GetBytes().size(),
+           samples.size(), sample_bytes);
+}
+
+void DictionaryTrainer::Add(std::shared_ptr<const ZSTDDictionary> dict, bool latest) {
+  std::scoped_lock lock(mutex_);
+  if (auto found = UnsafeFind(dict->GetId())) {
+    dict = std::move(found);
+  } else {
+    auto seq = next_seq_++;
+    dictionaries_.emplace(seq, dict);
+    UnsafeSave(seq, *dict);
+    LOG_INFO("同步字典{}：{} 字节", dict->GetId(), dict->GetBytes().size());
+  }
+  if (latest || !latest_) {
+    latest_ = std::move(dict);
+  }
+}
+
+std::shared_ptr<const ZSTDDictionary> DictionaryTrainer::GetLatest() {
+  std::scoped_lock lock(mutex_);
+  return latest_;
+}
+
+std::shared_ptr<const ZSTDDictionary> DictionaryTrainer::TryGet(std::uint32_t id) {
+  std::scoped_lock lock(mutex_);
+  return UnsafeFind(id);
+}
+
+void DictionaryTrainer::AddRefs(const std::vector<std::uint32_t>& ids) {
+  std::scoped_lock lock(mutex_);
+  for (auto id : ids) {
+    ++refs_[id];
+  }
+}
+
+void DictionaryTrainer::ReleaseRefs(const std::vector<std::uint32_t>& ids) {
+  std::scoped_lock lock(mutex_);
+  for (auto id : ids) {
+    if (auto iter = refs_.find(id); iter != refs_.end() && --iter->second == 0) {
+      refs_.erase(iter);
+    }
+  }
+}
+
+void DictionaryTrainer::OnRefsLoaded() {
+  std::scoped_lock lock(mutex_);
+  refs_loaded_ = true;
+}
+
+void DictionaryTrainer::RemoveUnreferenced() {
+  std::scoped_lock lock(mutex_);
+  if (!refs_loaded_) {
+    return; // 还不知道已有条目引用了哪些字典
+  }
+  std::vector<std::uint64_t> unused;
+  std::size_t newer = 0;
+  for (auto iter = dictionaries_.rbegin(); iter != dictionaries_.rend(); ++iter, ++newer) {
+    auto&& dict = iter->second;
+    if (newer >= kKeepLatestDictionaries && dict != latest_ && !refs_.count(dict->GetId())) {
+      unused.push_back(iter->first);
+    }
+  }
+  for (auto seq : unused) {
+    LOG_INFO("删除不再被引用的字典{}", dictionaries_[seq]->GetId());
+    UnsafeRemove(seq);
+  }
+}
+
+std::shared_ptr<const ZSTDDictionary> DictionaryTrainer::UnsafeFind(std::uint32_t id) {
+  for (auto&& [_, e] : dictionaries_) {
+    if (e->GetId() == id) {
+      return e;
+    }
+  }
+  return nullptr;
+}
+
+void DictionaryTrainer::Load() {
+  if (dir_.empty()) {
+    return;
+  }
+  Mkdirs(dir_);
+  for (auto&& node : GetDirNodes(dir_)) {
+    if (!node.is_regular || !StartWith(node.name, kFilePrefix) || EndWith(node.name, ".tmp")) {
+      continue;
+    }
+    auto path = fmt::format("{}/{}", dir_, node.name);
+    std::uint64_t seq = std::strtoull(node.name.c_str() + kFilePrefix.size(), nullptr, 10);
+    auto bytes = ReadFile(path);
+    auto dict = bytes ? ZSTDDictionary::Create(std::move(*bytes)) : nullptr;
+    if (!dict) {
+      LOG_WARN("忽略无法识别的字典文件`{}`", path);
+      continue;
+    }
+    dictionaries_.emplace(seq, std::move(dict));
+    next_seq_ = std::max(next_seq_, seq + 1);
+  }
+  if (!dictionaries_.empty()) {
+    latest_ = dictionaries_.rbegin()->second;
+  }
+  LOG_INFO("加载了 {} 个字典", dictionaries_.size());
+}
+
+void DictionaryTrainer::UnsafeSave(std::uint64_t seq, const ZSTDDictionary& dict) {
+  if (dir_.empty()) {
+    return;
+  }
+  auto path = GetPath(seq, dict);
+  auto temp_path = path + ".tmp";
+  std::ofstream ofs(temp_path, std::ios::binary);
+  ofs.write(dict.GetBytes().data(), dict.GetBytes().size());
+  ofs.close();
+  if (!ofs || rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG_WARN("保存字典`{}`失败", path);
+    unlink(temp_path.c_str());
+  }
+}
+
+void DictionaryTrainer::UnsafeRemove(std::uint64_t seq) {
+  auto iter = dictionaries_.find(seq);
+  if (!dir_.empty()) {
+    unlink(GetPath(seq, *iter->second).c_str());
+  }
+  dictionaries_.erase(iter);
+}
+
+std::string DictionaryTrainer::GetPath(std::uint64_t seq, const ZSTDDictionary& dict) const {
+  return fmt::format("{}/{}{:06}-{}", dir_, kFilePrefix, seq, dict.GetId());
+}
+
+} // namespace distribuild::cache
@@ -0,0 +1,90 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "common/crypto/zstd.h"
+#include "cache/buffer.h"
+
+namespace distribuild::cache {
+
+/// @brief 从近期写入的缓存条目中采样编译产物，训练zstd字典
+/// 小的目标文件之间有大量相同的结构（ELF头、符号表、公共头文件生成的内容），使用字典压缩率明显更高。
+/// 字典保存为`{dir}/dict-{序号}-{ID}`，重启后仍能提供给daemon解压使用旧字典的条目。
+/// 仍有条目引用的字典不会删除，否则这些条目无法再解压
+class DictionaryTrainer {
+ public:
+  /// @param dir 保存字典的目录，为空则不保存
+  explicit DictionaryTrainer(std::string dir);
+
+  /// @brief 写入条目后调用，每kSampleInterval个条目记录一个key作为样本
+  void OnEntryWritten(const std::string& key);
+
+  /// @brief 读取采样的条目并训练新字典，样本不足时不训练
+  /// @param read 读取条目，条目已被淘汰时返回空
+  void Train(const std::function<std::optional<Buffer>(const std::string& key)>& read);
+
+  /// @brief 加入从训练字典的节点同步的字典
+  /// @param latest 是否为该节点最新的字典，按ID获取的旧字典不作为最新的字典
+  void Add(std::shared_ptr<const ZSTDDictionary> dict, bool latest);
+
+  /// @brief 最新的字典，尚未训练时返回空
+  std::shared_ptr<const ZSTDDictionary> GetLatest();
+
+  /// @brief 按ID查找字典
+  std::shared_ptr<const ZSTDDictionary> TryGet(std::uint32_t id);
+
+  /// @brief 条目加入时记录它引用的字典
+  void AddRefs(const std::vector<std::uint32_t>& ids);
+
+  /// @brief 条目移除时释放它引用的字典，字典在RemoveUnreferenced时才删除
+  void ReleaseRefs(const std::vector<std::uint32_t>& ids);
+
+  /// @brief 已统计完启动时已有条目引用的字典，此前不删除任何字典
+  void OnRefsLoaded();
+
+  /// @brief 删除没有条目引用的旧字典，最新的kKeepLatestDictionaries个总是保留
+  void RemoveUnreferenced();
+
+ private:
+  static constexpr std::size_t kSampleInterval = 8;
+  static constexpr std::size_t kMaxSampleKeys = 4'096;
+  static constexpr std::size_t kMinSamples = 256;                // 样本文件少于该值时不训练
+  static constexpr std::size_t kMaxSampleFileSize = 1 << 20;     // 大文件用字典收益很小，不作为样本
+  static constexpr std::size_t kMaxSampleBytes = 64 << 20;
+  static constexpr std::size_t kDictionarySize = 112 << 10;
+  static constexpr std::size_t kKeepLatestDictionaries = 2;      // servant可能仍在用上一个字典压缩，即使还没有条目引用也保留
+
+  /// @brief 加载已保存的字典
+  void Load();
+
+  /// @brief 按ID查找字典，需持有mutex_
+  std::shared_ptr<const ZSTDDictionary> UnsafeFind(std::uint32_t id);
+
+  /// @brief 保存字典，需持有mutex_
+  void UnsafeSave(std::uint64_t seq, const ZSTDDictionary& dict);
+
+  /// @brief 移除字典及其文件，需持有mutex_
+  void UnsafeRemove(std::uint64_t seq);
+
+  std::string GetPath(std::uint64_t seq, const ZSTDDictionary& dict) const;
+
+ private:
+  const std::string dir_;
+
+  std::mutex mutex_;
+  std::size_t written_ = 0;
+  std::deque<std::string> sample_keys_;                          // 近期写入的条目
+  std::uint64_t next_seq_ = 0;
+  std::map<std::uint64_t, std::shared_ptr<const ZSTDDictionary>> dictionaries_; // 序号 -> 字典
+  std::shared_ptr<const ZSTDDictionary> latest_;
+  std::unordered_map<std::uint32_t, std::size_t> refs_;         // 字典ID -> 引用它的条目数
+  bool refs_loaded_ = false;
+};
+
+} // namespace distribuild::cache
@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "cache/disk_cache.h"
+#include "common/spdlogging.h"
+#include "common/hash.h"
+#include "common/tools.h"
+#include "common/dir.h"
+#include "common/io.h"
+
+namespace distribuild::cache {
+
+namespace {
+
+/// @brief key会被用作文件名，只允许安全字符
+bool IsValidKey(const std::string& key) {
+  return !key.empty() && std::all_of(key.begin(), key.end(), [](char c) {
+    return isalnum(c) || c == '-' || c == '_';
+  });
+}
+
+/// @brief 只读映射整个文件，Buffer释放时解除映射
+std::optional<Buffer> MapFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat buf;
+  if (fstat(fd, &buf) != 0) {
+    close(fd);
+    return std::nullopt;
+  }
+  std::size_t size = buf.st_size;
+  if (size == 0) {
+    close(fd);
+    return Buffer();
+  }
+
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // 映射建立后即可关闭，文件被删除也不影响已有映射
+  if (addr == MAP_FAILED) {
+    LOG_WARN("映射文件`{}`失败", path);
+    return std::nullopt;
+  }
+  madvise(addr, size, MADV_SEQUENTIAL);
+
+  std::shared_ptr<const void> owner(addr, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+  return Buffer(std::move(owner), static_cast<const char*>(addr), size);
+}
+
+std::int64_t NowSeconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+class DiskCache::Writer : public EntryWriter {
+ public:
+  Writer(DiskCache* cache, std::string key, std::uint32_t cost_ms, std::string temp_path, int fd)
+    : cache_(cache), key_(std::move(key)), cost_ms_(cost_ms), temp_path_(std::move(temp_path)), fd_(fd) {
+    if (cache_->chunks_) {
+      chunk_writer_ = std::make_unique<ChunkStore::Writer>(cache_->chunks_.get());
+    }
+  }
+
+  ~Writer() override { Abort(); }
+
+  bool Append(std::string_view bytes) override {
+    if (fd_ < 0) {
+      return false;
+    }
+    size_ += bytes.size();
+    if (size_ > cache_->max_size_) {
+      Abort();
+      return false;
+    }
+    if (chunk_writer_) {
+      // 内容写入块存储，临时文件只在Commit时写入清单
+      if (!chunk_writer_->Append(bytes)) {
+        Abort();
+        return false;
+      }
+      return true;
+    }
+    return WriteFully(bytes);
+  }
+
+  bool Commit() override {
+    if (fd_ < 0) {
+      return false;
+    }
+    std::optional<std::string> manifest;
+    if (chunk_writer_) {
+      // Finish成功后块的引用由清单持有
+      manifest = chunk_writer_->Finish();
+      chunk_writer_.reset();
+      if (!manifest) {
+        Abort();
+        return false;
+      }
+      if (!WriteFully(*manifest)) {
+        cache_->chunks_->Release(*manifest);
+        return false;
+      }
+    }
+    close(fd_);
+    fd_ = -1;
+    auto result = cache_->Publish(key_, temp_path_, size_, cost_ms_);
+    temp_path_.clear();
+    if (!result && manifest) {
+      cache_->chunks_->Release(*manifest);
+    }
+    return result;
+  }
+
+  void Abort() override {
+    chunk_writer_.reset(); // 释放已写入的块
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+    if (!temp_path_.empty()) {
+      unlink(temp_path_.c_str());
+      temp_path_.clear();
+    }
+  }
+
+ private:
+  bool WriteFully(std::string_view bytes) {
+    if (!distribuild::WriteFully(fd_, bytes)) {
+      LOG_WARN("写入临时文件`{}`失败", temp_path_);
+      Abort();
+      return false;
+    }
+    return true;
+  }
+
+  DiskCache* cache_;
+  std::string key_;
+  std::uint32_t cost_ms_;
+  std::string temp_path_;
+  int fd_;
+  std::size_t size_ = 0;
+  std::unique_ptr<ChunkStore::Writer> chunk_writer_;
+};
+
+DiskCache::DiskCache(std::string dir, std::size_t max_size, bool dedup)
+  : dir_(std::move(dir))
+  , max_size_(max_size)
+  , journal_(dir_) {
+  // 清除上次未完成的写入
+  auto temp_dir = fmt::format("{}/tmp", dir_);
+  if (access(temp_dir.c_str(), F_OK) == 0) {
+    RemoveDir(temp_dir);
+  }
+  Mkdirs(temp_dir);
+
+  if (dedup) {
+    chunks_ = std::make_unique<ChunkStore>(fmt::format("{}/chunks", dir_), temp_dir);
+    LoadChunkRefs();
+  }
+
+  if (auto records = journal_.Replay()) {
+    // 回放日志后即可提供服务，Start后在后台核对目录
+    std::scoped_lock lock(mutex_);
+    for (auto&& e : *records) {
+      UnsafeInsert(e.key, e.size, e.cost_ms, e.atime);
+    }
+    journal_.Open();
+    need_verify_ = true;
+  } else {
+    // 首次启动，扫描目录并写入快照
+    LoadEntries();
+    journal_.Open();
+    Compact();
+  }
+  LOG_INFO("磁盘缓存目录：`{}`，已有 {} 个条目共 {} 字节，占用 {} 字节，大小上限：{} 字节",
+           dir_, entries_.size(), used_size_, UnsafeGetUsedSize(), max_size_);
+}
+
+void DiskCache::Start() {
+  // 核对时修正的条目通过回调通知，需在设置回调之后启动
+  if (need_verify_ && !verifier_.joinable()) {
+    verifier_ = std::thread([this] { VerifyEntries(); });
+  }
+}
+
+DiskCache::~DiskCache() {
+  stopping_.store(true, std::memory_order_relaxed);
+  if (verifier_.joinable()) {
+    verifier_.join();
+  }
+}
+
+std::vector<std::string> DiskCache::GetKeys() {
+  std::vector<std::string> result;
+  std::shared_lock lock(mutex_);
+  result.reserve(entries_.size());
+  for (auto&& [k, _] : entries_) {
+    result.push_back(k);
+  }
+  return result;
+}
+
+std::optional<Buffer> DiskCache::TryGet(const std::string& key) {
+  {
+    // 只持有读锁，读者之间不会互相阻塞
+    std::shared_lock lock(mutex_);
+    auto iter = entries_.find(key);
+    if (iter == entries_.end()) {
+      return std::nullopt;
+    }
+    // 优先级在淘汰时才按命中次数重新计算，读者不需要写锁
+    iter->second.hits.fetch_add(1, std::memory_order_relaxed);
+    iter->second.atime.store(NowSeconds(), std::memory_order_relaxed);
+  }
+
+  return ReadEntry(key);
+}
+
+std::optional<Buffer> DiskCache::Peek(const std::string& key) {
+  {
+    std::shared_lock lock(mutex_);
+    if (!entries_.count(key)) {
+      return std::nullopt;
+    }
+  }
+  return ReadEntry(key);
+}
+
+std::optional<Buffer> DiskCache::ReadEntry(const std::string& key) {
+  // 在锁外映射文件，不把整个条目读入内存，即使文件此时被淘汰删除也只会读取失败
+  if (!chunks_) {
+    return MapFile(GetPath(key));
+  }
+  // 按清单拼接，块被淘汰删除时同样读取失败
+  auto manifest = ReadFile(GetPath(key));
+  return manifest ? chunks_->Read(*manifest) : std::nullopt;
+}
+
+void DiskCache::Put(const std::string& key, std::string_view bytes, std::uint32_t cost_ms) {
+  if (auto writer = BeginPut(key, cost_ms); writer && writer->Append(bytes)) {
+    writer->Commit();
+  }
+}
+
+std::unique_ptr<EntryWriter> DiskCache::BeginPut(const std::string& key, std::uint32_t cost_ms) {
+  if (!IsValidKey(key)) {
+    LOG_WARN("非法的缓存key：`{}`", key);
+    return nullptr;
+  }
+
+  // 先写临时文件再重命名，避免读到写了一半的文件
+  auto temp_path = fmt::format("{}/tmp/{}", dir_, next_temp_id_.fetch_add(1, std::memory_order_relaxed));
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG_WARN("创建临时文件`{}`失败", temp_path);
+    return nullptr;
+  }
+  return std::make_unique<Writer>(this, key, cost_ms, std::move(temp_path), fd);
+}
+
+std::optional<std::string> DiskCache::GetEvictionCandidate(const std::string& key) {
+  std::shared_lock lock(mutex_);
+  if (UnsafeGetUsedSize() * 100 < max_size_ * kAdmissionPercent || queue_.empty()) {
+    return std::nullopt;
+  }
+  return queue_.begin()->second->key;
+}
+
+void DiskCache::Purge() {
+  std::vector<std::string> evicted;
+  bool need_compact;
+
+  {
+    // 锁内只挑选并移出索引，日志写出与删除文件都在锁外进行，读者不会等待磁盘
+    // 开启去重时删除条目实际释放的空间未知，按平均去重比例估计，不足的部分留给下次Purge
+    std::scoped_lock lock(mutex_);
+    auto used = UnsafeGetUsedSize();
+    auto ratio = used_size_ ? static_cast<double>(used) / used_size_ : 1.0;
+    double freed = 0;
+    while (used > max_size_ + freed && !queue_.empty()) {
+      auto [priority, entry] = *queue_.begin();
+      auto hits = entry->hits.load(std::memory_order_relaxed);
+      if (hits != entry->counted_hits) {
+        // 入队后命中过，优先级只会升高，重新计算后放回
+        queue_.erase(queue_.begin());
+        entry->counted_hits = hits;
+        entry->priority = UnsafeGetPriority(*entry);
+        queue_.emplace(entry->priority, entry);
+        continue;
+      }
+      inflation_ = priority; // 之后加入或命中的条目优先级都高于已淘汰的条目
+      freed += entry->size * ratio;
+      evicted.push_back(entry->key);
+      removing_.insert(entry->key);
+      UnsafeJournal(*entry, true);
+      UnsafeErase(entry);
+    }
+    need_compact = journal_.GetPendingRecords() > std::max(entries_.size(), kMinCompactRecords);
+  }
+  journal_.Flush();
+
+  std::size_t removed = 0;
+  for (auto&& key : evicted) {
+    // 持有文件锁时同名条目不会被发布，此时仍不在索引中的文件才是被淘汰的文件
+    std::scoped_lock file_lock(GetFileMutex(key));
+    {
+      std::scoped_lock lock(mutex_);
+      removing_.erase(key);
+      if (entries_.count(key)) {
+        continue;
+      }
+    }
+    RemoveFile(GetPath(key));
+    ++removed;
+  }
+  if (removed) {
+    LOG_DEBUG("磁盘缓存淘汰了 {} 个条目", removed);
+  }
+
+  // 日志比索引本身还大时压缩，控制下次启动的回放时间
+  if (need_compact) {
+    Compact();
+  }
+}
+
+bool DiskCache::Publish(const std::string& key, const std::string& temp_path, std::size_t size, std::uint32_t cost_ms) {
+  Mkdirs(GetShardDir(key));
+  auto path = GetPath(key);
+  std::optional<std::string> replaced;
+  {
+    // 重命名只持有文件锁，与Purge删除同名文件互斥；写锁只在更新索引时持有
+    std::scoped_lock file_lock(GetFileMutex(key));
+    if (chunks_) {
+      replaced = ReadFile(path); // 覆盖已有的清单时由这里释放它持有的块
+    }
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+      LOG_WARN("重命名缓存文件`{}`失败", temp_path);
+      unlink(temp_path.c_str());
+      return false;
+    }
+
+    std::scoped_lock lock(mutex_);
+    if (auto iter = entries_.find(key); iter != entries_.end()) {
+      UnsafeErase(&iter->second);
+    }
+    UnsafeJournal(UnsafeInsert(key, size, cost_ms, NowSeconds()), false);
+  }
+  journal_.Flush();
+  if (replaced) {
+    chunks_->Release(*replaced);
+  }
+  return true;
+}
+
+std::string DiskCache::GetShardDir(const std::string& key) const {
+  auto hash = Hash64(key);
+  return fmt::format("{}/{:02x}/{:02x}", dir_, (hash >> 8) & 0xff, hash & 0xff);
+}
+
+std::string DiskCache::GetPath(const std::string& key) const {
+  return fmt::format("{}/{}", GetShardDir(key), key);
+}
+
+std::mutex& DiskCache::GetFileMutex(const std::string& key) {
+  return file_mutexes_[Hash64(key) % kFileLockShards];
+}
+
+void DiskCache::ScanFiles(const std::function<void(const std::string& key, const std::string& path)>& callback) {
+  for (auto&& node : GetDirNodesRecursively(dir_)) {
+    // 顶层是索引日志等文件
+    if (!node.is_regular || StartWith(node.name, "tmp/") || StartWith(node.name, "chunks/") ||
+        node.name.find('/') == std::string::npos) {
+      continue;
+    }
+    auto key = node.name.substr(node.name.find_last_of('/') + 1);
+    auto path = fmt::format("{}/{}", dir_, node.name);
+    if (!IsValidKey(key) || path != GetPath(key)) {
+      LOG_WARN("忽略无法识别的缓存文件`{}`", path);
+      continue;
+    }
+    callback(key, path);
+  }
+}
+
+void DiskCache::LoadEntries() {
+  std::scoped_lock lock(mutex_);
+  ScanFiles([&](const std::string& key, const std::string& path) {
+    struct stat buf;
+    if (stat(path.c_str(), &buf) != 0) {
+      return;
+    }
+    if (auto size = GetEntrySize(path, buf)) {
+      UnsafeInsert(key, *size, 0, buf.st_atime); // 编译耗时未保存，按默认值
+    }
+  });
+}
+
+void DiskCache::VerifyEntries() {
+  std::uint64_t version;
+  {
+    std::shared_lock lock(mutex_);
+    version = next_version_;
+  }
+
+  std::size_t fixed = 0, recovered = 0;
+  ScanFiles([&](const std::string& key, const std::string& path) {
+    if (stopping_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    struct stat buf;
+    if (stat(path.c_str(), &buf) != 0) {
+      return;
+    }
+    auto size = GetEntrySize(path, buf);
+    if (!size) {
+      return;
+    }
+
+    {
+      std::shared_lock lock(mutex_);
+      auto iter = entries_.find(key);
+      if (iter != entries_.end() && iter->second.size == *size) {
+        iter->second.verified.store(true, std::memory_order_relaxed);
+        return;
+      }
+    }
+
+    // 持有文件锁，期间文件不会被发布或删除，重新读取后再与索引比较
+    std::scoped_lock file_lock(GetFileMutex(key));
+    if (stat(path.c_str(), &buf) != 0 || !(size = GetEntrySize(path, buf))) {
+      return;
+    }
+    std::scoped_lock lock(mutex_);
+    if (auto iter = entries_.find(key); iter != entries_.end()) {
+      if (iter->second.size == *size) {
+        iter->second.verified.store(true, std::memory_order_relaxed);
+        return;
+      }
+      // 日志中的大小与文件不一致，以文件为准
+      auto cost_ms = iter->second.cost_ms;
+      UnsafeErase(&iter->second);
+      auto&& entry = UnsafeInsert(key, *size, cost_ms, buf.st_atime);
+      entry.verified.store(true, std::memory_order_relaxed);
+      UnsafeJournal(entry, false);
+      ++fixed;
+    } else if (!removing_.count(key)) {
+      // 记录丢失在损坏的日志尾部的条目，文件完好，重新加入索引；编译耗时未知，按默认值
+      auto&& entry = UnsafeInsert(key, *size, 0, buf.st_atime);
+      entry.verified.store(true, std::memory_order_relaxed);
+      UnsafeJournal(entry, false);
+      ++recovered;
+    }
+  });
+
+  // 核对开始前就在索引中、但目录中没有的条目
+  std::vector<Entry*> missing;
+  {
+    std::scoped_lock lock(mutex_);
+    if (stopping_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    for (auto&& [_, entry] : entries_) {
+      if (entry.version < version && !entry.verified.load(std::memory_order_relaxed)) {
+        missing.push_back(&entry);
+      }
+    }
+    for (auto&& entry : missing) {
+      UnsafeJournal(*entry, true);
+      UnsafeErase(entry);
+    }
+  }
+  journal_.Flush();
+  LOG_INFO("磁盘缓存核对完成：修正 {} 个条目，重新加入 {} 个不在索引中的条目，移除 {} 个丢失的条目",
+           fixed, recovered, missing.size());
+}
+
+std::optional<std::size_t> DiskCache::GetEntrySize(const std::string& path, const struct stat& buf) const {
+  if (!chunks_) {
+    return buf.st_size;
+  }
+  auto manifest = ReadFile(path);
+  return manifest ? ChunkStore::GetEntrySize(*manifest) : std::nullopt;
+}
+
+void DiskCache::RemoveFile(const std::string& path) {
+  if (!chunks_) {
+    unlink(path.c_str());
+    return;
+  }
+  auto manifest = ReadFile(path);
+  unlink(path.c_str());
+  if (manifest) {
+    chunks_->Release(*manifest);
+  }
+}
+
+void DiskCache::LoadChunkRefs() {
+  // 每个清单文件持有其中块的引用，不是清单的文件（未开启去重时写入的条目）删除
+  std::size_t removed = 0;
+  ScanFiles([&](const std::string& key, const std::string& path) {
+    auto manifest = ReadFile(path);
+    if (!manifest || !chunks_->AddRefs(*manifest)) {
+      unlink(path.c_str());
+      ++removed;
+    }
+  });
+  if (removed) {
+    LOG_WARN("删除了 {} 个不是清单的缓存文件", removed);
+  }
+  chunks_->RemoveUnreferenced();
+}
+
+std::size_t DiskCache::UnsafeGetUsedSize() const {
+  return chunks_ ? chunks_->GetSize() : used_size_;
+}
+
+void DiskCache::Compact() {
+  std::vector<IndexJournal::Record> records;
+  {
+    // 追加日志都持有写锁，读锁足以保证换用日志时索引不变
+    std::shared_lock lock(mutex_);
+    if (!journal_.Rotate()) {
+      return;
+    }
+    records.reserve(entries_.size());
+    for (auto&& [key, entry] : entries_) {
+      records.push_back(IndexJournal::Record{
+        .removed = false,
+        .key     = key,
+        .size    = entry.size,
+        .cost_ms = entry.cost_ms,
+        .atime   = entry.atime.load(std::memory_order_relaxed),
+      });
+    }
+  }
+  journal_.WriteSnapshot(records);
+}
+
+void DiskCache::UnsafeJournal(const Entry& entry, bool removed) {
+  journal_.Append(IndexJournal::Record{
+    .removed = removed,
+    .key     = entry.key,
+    .size    = entry.size,
+    .cost_ms = entry.cost_ms,
+    .atime   = entry.atime.load(std::memory_order_relaxed),
+  });
+}
+
+double DiskCache::UnsafeGetPriority(const Entry& entry) const {
+  auto cost = entry.cost_ms ? entry.cost_ms : kDefaultCostMs;
+  return inflation_ + (1.0 + entry.counted_hits) * cost / std::max<std::size_t>(entry.size, 1);
+}
+
+DiskCache::Entry& DiskCache::UnsafeInsert(const std::string& key, std::size_t size, std::uint32_t cost_ms, std::int64_t atime) {
+  auto&& entry = entries_[key];
+  entry.key = key;
+  entry.size = size;
+  entry.cost_ms = cost_ms;
+  entry.version = next_version_++;
+  entry.atime.store(atime, std::memory_order_relaxed);
+  entry.priority = UnsafeGetPriority(entry);
+  queue_.emplace(entry.priority, &entry);
+  used_size_ += size;
+  Notify(key, true);
+  return entry;
+}
+
+void DiskCache::UnsafeErase(Entry* entry) {
+  used_size_ -= entry->size;
+  queue_.erase({entry->priority, entry});
+  Notify(entry->key, false);
+  entries_.erase(entries_.find(entry->key)); // entry随之销毁
+}
+
+} // namespace distribuild::cache
@@ -1,12 +1,144 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
 #include "cache/cache_engine.h"
+#include "cache/index_journal.h"
+#include "cache/chunk_store.h"
 
 namespace distribuild::cache {
 
-class Buffer;
-
+/// @brief 磁盘缓存，作为L2缓存
+/// 条目按key的哈希分片存放在`{dir}/xx/yy/{key}`，写入时先写`{dir}/tmp`再rename，
+/// 内存中只保存索引（大小、编译耗时、命中次数），按GDSF（GreedyDual-Size-Frequency）淘汰：
+/// 优先级 = L + (1 + 命中次数) * 编译耗时 / 大小，L为最近淘汰条目的优先级，
+/// 编译耗时长、体积小、反复命中的条目保留得更久。
+/// 索引的变更记入IndexJournal，重启时回放日志即可提供服务，Start后在后台线程核对目录。
+/// 开启去重时条目文件只保存ChunkStore的清单，内容按块存放在`{dir}/chunks`，占用按块的总大小计算
 class DiskCache : public CacheEngine {
-  
+ public:
+  /// @param dir 缓存目录
+  /// @param max_size 允许占用的最大字节数
+  /// @param dedup 是否按内容定义分块去重，切换时需清空目录
+  DiskCache(std::string dir, std::size_t max_size, bool dedup = false);
+
+  ~DiskCache() override;
+
+  /// @brief 回放了索引日志时，启动后台线程核对目录
+  void Start() override;
+
+  std::vector<std::string> GetKeys() override;
+  std::optional<Buffer> TryGet(const std::string& key) override;
+  std::optional<Buffer> Peek(const std::string& key) override;
+  void Put(const std::string& key, std::string_view bytes, std::uint32_t cost_ms) override;
+  void Purge() override;
+
+  /// @brief 直接写入临时文件，Commit时rename发布
+  std::unique_ptr<EntryWriter> BeginPut(const std::string& key, std::uint32_t cost_ms) override;
+
+  /// @brief 占用超过容量的95%时返回优先级最低的条目
+  std::optional<std::string> GetEvictionCandidate(const std::string& key) override;
+
+ private:
+  class Writer;
+
+  static constexpr std::uint32_t kDefaultCostMs = 1'000;  // 未知编译耗时的条目按该值计算
+  static constexpr std::size_t kAdmissionPercent = 95;
+  static constexpr std::size_t kMinCompactRecords = 100'000; // 日志记录数超过该值与条目数时压缩
+  static constexpr std::size_t kFileLockShards = 64;
+
+  struct Entry {
+    std::string key;
+    std::size_t size = 0;
+    std::uint32_t cost_ms = 0;
+    double priority = 0;                  // 在淘汰队列中的优先级
+    std::uint32_t counted_hits = 0;       // 计算priority时的命中次数
+    std::atomic<std::uint32_t> hits{};    // 命中次数，只持有读锁时更新
+    std::atomic<std::int64_t> atime{};    // 最近访问时间（秒）
+    std::uint64_t version = 0;            // 加入索引的顺序
+    std::atomic<bool> verified{};         // 后台核对时已在目录中找到
+  };
+
+  /// @brief 获取条目所在分片目录
+  std::string GetShardDir(const std::string& key) const;
+
+  /// @brief 获取条目文件路径
+  std::string GetPath(const std::string& key) const;
+
+  /// @brief 读取条目文件，不持有锁，文件已被删除时返回空
+  std::optional<Buffer> ReadEntry(const std::string& key);
+
+  /// @brief 发布写好的临时文件
+  bool Publish(const std::string& key, const std::string& temp_path, std::size_t size, std::uint32_t cost_ms);
+
+  /// @brief 条目大小，开启去重时从清单中读取
+  std::optional<std::size_t> GetEntrySize(const std::string& path, const struct stat& buf) const;
+
+  /// @brief key的文件锁
+  std::mutex& GetFileMutex(const std::string& key);
+
+  /// @brief 删除条目文件，开启去重时释放清单持有的块；需持有文件锁，不能持有mutex_
+  void RemoveFile(const std::string& path);
+
+  /// @brief 开启去重时，按目录中的清单重建块的引用计数
+  void LoadChunkRefs();
+
+  /// @brief 当前占用，需持有锁
+  std::size_t UnsafeGetUsedSize() const;
+
+  /// @brief 遍历目录下所有条目文件
+  void ScanFiles(const std::function<void(const std::string& key, const std::string& path)>& callback);
+
+  /// @brief 没有索引日志时，扫描目录得到索引
+  void LoadEntries();
+
+  /// @brief 回放日志得到的索引可能与目录不一致（崩溃时丢失的日志尾部），在后台核对修正：
+  /// 大小以文件为准，目录中没有的条目移出索引，不在索引中的文件重新加入索引
+  void VerifyEntries();
+
+  /// @brief 把当前索引写为快照，换用新日志
+  void Compact();
+
+  /// @brief 追加日志记录到缓冲区，需持有写锁
+  void UnsafeJournal(const Entry& entry, bool removed);
+
+  /// @brief 按当前的L计算优先级，需持有写锁
+  double UnsafeGetPriority(const Entry& entry) const;
+
+  /// @brief 加入索引，需持有写锁
+  Entry& UnsafeInsert(const std::string& key, std::size_t size, std::uint32_t cost_ms, std::int64_t atime);
+
+  /// @brief 移出索引，需持有写锁
+  void UnsafeErase(Entry* entry);
+
+ private:
+  const std::string dir_;
+  const std::size_t max_size_;
+  std::atomic<std::uint64_t> next_temp_id_{};
+  std::unique_ptr<ChunkStore> chunks_;              // 开启去重时存放条目内容
+  // 按key的哈希分片，发布、删除条目文件时持有，文件操作与同名条目的索引变更不会交错，
+  // 开启去重时每个清单只被释放一次；需要同时持有时先持有文件锁再持有mutex_
+  std::array<std::mutex, kFileLockShards> file_mutexes_;
+
+  std::shared_mutex mutex_;
+  std::size_t used_size_ = 0;
+  double inflation_ = 0;                            // GDSF中的L
+  std::unordered_map<std::string, Entry> entries_;
+  std::unordered_set<std::string> removing_;        // Purge已移出索引、尚未删除文件的key
+  std::set<std::pair<double, Entry*>> queue_;       // 淘汰队列，按优先级从低到高
+  std::uint64_t next_version_ = 0;
+  IndexJournal journal_;                            // 追加记录时需持有写锁，在锁外Flush
+
+  bool need_verify_ = false;                        // 索引来自日志回放，需要核对目录
+  std::atomic<bool> stopping_{};
+  std::thread verifier_;
 };
 
 } // namespace distribuild::cache
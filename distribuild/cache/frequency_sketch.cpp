@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <bit>
+#include "cache/frequency_sketch.h"
+
+namespace distribuild::cache {
+
+FrequencySketch::FrequencySketch(std::size_t capacity)
+  : width_(std::bit_ceil(std::max<std::size_t>(capacity, 64)))
+  , sample_size_(width_ * 10)
+  , table_(width_ * kRows / 2) {}
+
+void FrequencySketch::Increment(std::uint64_t hash) {
+  bool added = false;
+  for (int row = 0; row < kRows; ++row) {
+    auto index = GetIndex(hash, row);
+    auto shift = index % 2 * 4;
+    if (((table_[index / 2] >> shift) & 0x0f) < kMaxCount) {
+      table_[index / 2] += 1 << shift;
+      added = true;
+    }
+  }
+  if (added && ++additions_ >= sample_size_) {
+    Reset();
+  }
+}
+
+std::uint32_t FrequencySketch::Estimate(std::uint64_t hash) const {
+  std::uint8_t result = kMaxCount;
+  for (int row = 0; row < kRows; ++row) {
+    result = std::min(result, GetCounter(GetIndex(hash, row)));
+  }
+  return result;
+}
+
+std::size_t FrequencySketch::GetIndex(std::uint64_t hash, int row) const {
+  // 双重哈希，每行使用不同的组合
+  auto h1 = static_cast<std::uint32_t>(hash);
+  auto h2 = static_cast<std::uint32_t>(hash >> 32) | 1;
+  return row * width_ + ((h1 + row * h2) & (width_ - 1));
+}
+
+std::uint8_t FrequencySketch::GetCounter(std::size_t index) const {
+  return (table_[index / 2] >> (index % 2 * 4)) & 0x0f;
+}
+
+void FrequencySketch::Reset() {
+  for (auto&& e : table_) {
+    e = (e >> 1) & 0x77;
+  }
+  additions_ /= 2;
+}
+
+} // namespace distribuild::cache
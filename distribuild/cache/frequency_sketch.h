@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace distribuild::cache {
+
+/// @brief 访问频率估计（TinyLFU），Count-Min Sketch，4行4位计数器
+/// 增加次数达到采样数后所有计数减半，频率反映的是近期的访问；线程不安全
+class FrequencySketch {
+ public:
+  /// @param capacity 需要区分的key数量
+  explicit FrequencySketch(std::size_t capacity);
+
+  /// @brief 记录一次访问
+  void Increment(std::uint64_t hash);
+
+  /// @brief 估计访问次数，不会低估（减半之前）
+  std::uint32_t Estimate(std::uint64_t hash) const;
+
+ private:
+  static constexpr int kRows = 4;
+  static constexpr std::uint8_t kMaxCount = 0x0f;
+
+  /// @brief 第row行中计数器的下标
+  std::size_t GetIndex(std::uint64_t hash, int row) const;
+
+  std::uint8_t GetCounter(std::size_t index) const;
+
+  /// @brief 所有计数减半
+  void Reset();
+
+ private:
+  std::size_t width_;                 // 每行计数器数，2的幂
+  std::size_t sample_size_;           // 增加次数达到该值时减半
+  std::size_t additions_ = 0;
+  std::vector<std::uint8_t> table_;   // 每字节两个计数器
+};
+
+} // namespace distribuild::cache
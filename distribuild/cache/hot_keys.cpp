@@ -0,0 +1,61 @@
+#include <algorithm>
+#include "cache/hot_keys.h"
+
+namespace distribuild::cache {
+
+HotKeys::HotKeys(std::size_t capacity)
+  : capacity_(std::max<std::size_t>(capacity, 1)) {}
+
+void HotKeys::Hit(const std::string& key) {
+  auto iter = counts_.find(key);
+  if (iter != counts_.end()) {
+    ordered_.erase({iter->second, key});
+    ordered_.emplace(++iter->second, key);
+    return;
+  }
+
+  std::uint64_t count = 1;
+  if (counts_.size() >= capacity_) {
+    // 替换计数最小的key，新key继承其计数
+    auto min = ordered_.begin();
+    count = min->first + 1;
+    counts_.erase(min->second);
+    ordered_.erase(min);
+  }
+  counts_.emplace(key, count);
+  ordered_.emplace(count, key);
+}
+
+void HotKeys::Remove(const std::string& key) {
+  auto iter = counts_.find(key);
+  if (iter == counts_.end()) {
+    return;
+  }
+  ordered_.erase({iter->second, key});
+  counts_.erase(iter);
+}
+
+void HotKeys::Decay() {
+  std::set<std::pair<std::uint64_t, std::string>> ordered;
+  for (auto iter = counts_.begin(); iter != counts_.end();) {
+    iter->second /= 2;
+    if (iter->second == 0) {
+      iter = counts_.erase(iter);
+      continue;
+    }
+    ordered.emplace(iter->second, iter->first);
+    ++iter;
+  }
+  ordered_ = std::move(ordered);
+}
+
+std::vector<std::pair<std::string, std::uint64_t>> HotKeys::GetTop(std::size_t count) const {
+  std::vector<std::pair<std::string, std::uint64_t>> result;
+  result.reserve(std::min(count, ordered_.size()));
+  for (auto iter = ordered_.rbegin(); iter != ordered_.rend() && result.size() < count; ++iter) {
+    result.emplace_back(iter->second, iter->first);
+  }
+  return result;
+}
+
+} // namespace distribuild::cache
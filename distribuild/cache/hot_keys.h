@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace distribuild::cache {
+
+/// @brief 命中最多的key（Space-Saving），只跟踪固定数量的key，内存有上限
+/// 未跟踪的key命中时替换计数最小的key并继承其计数，计数可能高估但不会低估；线程不安全
+class HotKeys {
+ public:
+  /// @param capacity 跟踪的key数，应为需要的热点数的数倍
+  explicit HotKeys(std::size_t capacity);
+
+  /// @brief 记录一次命中
+  void Hit(const std::string& key);
+
+  /// @brief 不再跟踪key（如条目已被淘汰）
+  void Remove(const std::string& key);
+
+  /// @brief 所有计数减半，计数归零的key不再跟踪，热点反映的是近期的命中
+  void Decay();
+
+  /// @brief 按命中次数从多到少返回最多count个key
+  std::vector<std::pair<std::string, std::uint64_t>> GetTop(std::size_t count) const;
+
+ private:
+  std::size_t capacity_;
+  std::unordered_map<std::string, std::uint64_t> counts_;   // key -> 命中次数
+  std::set<std::pair<std::uint64_t, std::string>> ordered_; // (命中次数, key)，与counts_一致
+};
+
+} // namespace distribuild::cache
@@ -0,0 +1,261 @@
+#include <cstring>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cache/index_journal.h"
+#include "common/spdlogging.h"
+#include "common/hash.h"
+#include "common/io.h"
+
+namespace distribuild::cache {
+
+namespace {
+
+constexpr std::string_view kFileMagic = "DCIDX001"; // 日志与快照的文件头，格式变化时修改
+constexpr std::string_view kJournal = "index.journal";
+constexpr std::string_view kOldJournal = "index.journal.old";
+constexpr std::string_view kSnapshot = "index.snapshot";
+
+/// @brief 每条记录的头部，之后是payload
+struct RecordHeader {
+  std::uint32_t payload_size;
+  std::uint64_t checksum;  // Hash64(payload)
+} __attribute__((packed));
+
+/// @brief payload的固定部分，之后是key
+struct RecordFields {
+  std::uint8_t removed;
+  std::uint64_t size;
+  std::uint32_t cost_ms;
+  std::int64_t atime;
+} __attribute__((packed));
+
+} // namespace
+
+IndexJournal::IndexJournal(std::string dir)
+  : dir_(std::move(dir)) {}
+
+IndexJournal::~IndexJournal() {
+  Flush();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+std::optional<std::vector<IndexJournal::Record>> IndexJournal::Replay() {
+  std::vector<Record> records;
+  bool found = false;
+  for (auto&& name : {kSnapshot, kOldJournal, kJournal}) {
+    auto path = GetPath(name);
+    auto valid_size = ReplayFile(path, &records);
+    if (!valid_size) {
+      continue;
+    }
+    found = true;
+
+    // 截断日志损坏的尾部，之后追加的记录才能被回放
+    if (name == kJournal && truncate(path.c_str(), *valid_size) != 0) {
+      LOG_WARN("截断索引日志`{}`失败", path);
+    }
+  }
+  if (!found) {
+    return std::nullopt;
+  }
+
+  // 按顺序应用，同一个key以最后一条记录为准
+  std::unordered_map<std::string, Record> entries;
+  for (auto&& e : records) {
+    if (e.removed) {
+      entries.erase(e.key);
+    } else {
+      entries[e.key] = std::move(e);
+    }
+  }
+
+  std::vector<Record> result;
+  result.reserve(entries.size());
+  for (auto&& [_, e] : entries) {
+    result.push_back(std::move(e));
+  }
+  LOG_INFO("回放索引日志：{} 条记录，{} 个条目", records.size(), result.size());
+  return result;
+}
+
+bool IndexJournal::Open() {
+  std::scoped_lock lock(file_mutex_);
+  return UnsafeOpen();
+}
+
+bool IndexJournal::UnsafeOpen() {
+  auto path = GetPath(kJournal);
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    LOG_WARN("打开索引日志`{}`失败", path);
+    return false;
+  }
+  struct stat buf;
+  if (fstat(fd_, &buf) == 0 && buf.st_size == 0 && !WriteFully(fd_, kFileMagic)) {
+    LOG_WARN("写入索引日志`{}`失败", path);
+  }
+  return true;
+}
+
+void IndexJournal::Append(const Record& record) {
+  std::string bytes;
+  Encode(record, &bytes);
+  std::scoped_lock lock(buffer_mutex_);
+  buffer_.append(bytes);
+  pending_records_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void IndexJournal::Flush() {
+  std::scoped_lock lock(file_mutex_);
+  UnsafeFlush();
+}
+
+void IndexJournal::UnsafeFlush() {
+  // 取出缓冲区后在buffer_mutex_外写入，Append不会等待磁盘
+  std::string bytes;
+  {
+    std::scoped_lock lock(buffer_mutex_);
+    bytes.swap(buffer_);
+  }
+  if (fd_ < 0 || bytes.empty()) {
+    return;
+  }
+  // 写入失败只影响重启速度，启动后的校验会修正索引
+  if (!WriteFully(fd_, bytes)) {
+    LOG_WARN("写入索引日志失败");
+  }
+}
+
+bool IndexJournal::Rotate() {
+  std::scoped_lock lock(file_mutex_);
+  UnsafeFlush();
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+
+  auto journal = GetPath(kJournal);
+  auto old_journal = GetPath(kOldJournal);
+  if (access(old_journal.c_str(), F_OK) == 0) {
+    // 上次的快照没有写成功，旧日志仍然需要，把当前日志接在后面
+    auto bytes = ReadFile(journal);
+    int fd = open(old_journal.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    bool succeeded = bytes && fd >= 0 && bytes->size() >= kFileMagic.size() &&
+                     WriteFully(fd, std::string_view(*bytes).substr(kFileMagic.size()));
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (!succeeded || unlink(journal.c_str()) != 0) {
+      LOG_WARN("合并索引日志失败");
+      UnsafeOpen();
+      return false;
+    }
+  } else if (rename(journal.c_str(), old_journal.c_str()) != 0) {
+    LOG_WARN("重命名索引日志失败");
+    UnsafeOpen();
+    return false;
+  }
+
+  pending_records_.store(0, std::memory_order_relaxed);
+  return UnsafeOpen();
+}
+
+bool IndexJournal::WriteSnapshot(const std::vector<Record>& entries) {
+  std::string bytes(kFileMagic);
+  for (auto&& e : entries) {
+    Encode(e, &bytes);
+  }
+
+  // 写临时文件再rename，崩溃时旧快照与旧日志仍然完整
+  auto temp_path = GetPath("index.snapshot.tmp");
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG_WARN("创建索引快照`{}`失败", temp_path);
+    return false;
+  }
+  bool succeeded = WriteFully(fd, bytes) && fsync(fd) == 0;
+  close(fd);
+  if (!succeeded || rename(temp_path.c_str(), GetPath(kSnapshot).c_str()) != 0) {
+    LOG_WARN("写入索引快照失败");
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  unlink(GetPath(kOldJournal).c_str());
+  LOG_INFO("写入索引快照：{} 个条目，{} 字节", entries.size(), bytes.size());
+  return true;
+}
+
+void IndexJournal::Encode(const Record& record, std::string* to) {
+  RecordFields fields{
+    .removed = record.removed,
+    .size    = record.size,
+    .cost_ms = record.cost_ms,
+    .atime   = record.atime,
+  };
+  std::string payload(reinterpret_cast<const char*>(&fields), sizeof(fields));
+  payload.append(record.key);
+
+  RecordHeader header{
+    .payload_size = static_cast<std::uint32_t>(payload.size()),
+    .checksum     = Hash64(payload),
+  };
+  to->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  to->append(payload);
+}
+
+bool IndexJournal::Decode(std::string_view* from, Record* record) {
+  RecordHeader header;
+  if (from->size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, from->data(), sizeof(header));
+  if (header.payload_size < sizeof(RecordFields) || from->size() - sizeof(header) < header.payload_size) {
+    return false;
+  }
+  auto payload = from->substr(sizeof(header), header.payload_size);
+  if (Hash64(payload) != header.checksum) {
+    return false;
+  }
+
+  RecordFields fields;
+  memcpy(&fields, payload.data(), sizeof(fields));
+  record->removed = fields.removed;
+  record->size = fields.size;
+  record->cost_ms = fields.cost_ms;
+  record->atime = fields.atime;
+  record->key = payload.substr(sizeof(fields));
+  from->remove_prefix(sizeof(header) + header.payload_size);
+  return true;
+}
+
+std::optional<std::size_t> IndexJournal::ReplayFile(const std::string& path, std::vector<Record>* records) {
+  auto bytes = ReadFile(path);
+  if (!bytes) {
+    return std::nullopt;
+  }
+  std::string_view from(*bytes);
+  if (from.substr(0, kFileMagic.size()) != kFileMagic) {
+    LOG_WARN("无法识别的索引文件`{}`", path);
+    return 0;
+  }
+  from.remove_prefix(kFileMagic.size());
+
+  Record record;
+  while (Decode(&from, &record)) {
+    records->push_back(std::move(record));
+  }
+  if (!from.empty()) {
+    LOG_WARN("索引文件`{}`尾部有 {} 字节损坏，已忽略", path, from.size());
+  }
+  return bytes->size() - from.size();
+}
+
+std::string IndexJournal::GetPath(std::string_view name) const {
+  return fmt::format("{}/{}", dir_, name);
+}
+
+} // namespace distribuild::cache
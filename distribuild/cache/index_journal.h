@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace distribuild::cache {
+
+/// @brief 磁盘缓存索引的日志
+/// 索引的每次变更追加一条记录到`{dir}/index.journal`，定期把整个索引压缩为快照`{dir}/index.snapshot`并换用新日志；
+/// 启动时回放 快照 + 旧日志 + 日志 即可得到索引，不需要扫描目录。
+/// 每条记录带校验和，回放到第一条不完整或损坏的记录为止（进程崩溃时写了一半的尾部）。
+/// Append只追加到内存缓冲区，Flush在另一把锁内写出，调用者可以在自己的锁外Flush
+class IndexJournal {
+ public:
+  struct Record {
+    bool removed = false;
+    std::string key;
+    std::uint64_t size = 0;
+    std::uint32_t cost_ms = 0;
+    std::int64_t atime = 0;
+  };
+
+  explicit IndexJournal(std::string dir);
+
+  ~IndexJournal();
+
+  /// @brief 回放快照与日志，返回现存的条目；快照与日志都不存在时返回空
+  /// 需在Open之前调用，损坏的日志尾部会被截断
+  std::optional<std::vector<Record>> Replay();
+
+  /// @brief 打开日志准备追加
+  bool Open();
+
+  /// @brief 追加一条记录到缓冲区，同一个key的记录需按顺序追加
+  void Append(const Record& record);
+
+  /// @brief 写出缓冲区，可与Append并发调用
+  void Flush();
+
+  /// @brief 上次压缩以来追加的记录数
+  std::size_t GetPendingRecords() const noexcept { return pending_records_.load(std::memory_order_relaxed); }
+
+  /// @brief 换用新日志，之后的记录写入新日志，旧日志保留到快照写完
+  /// 调用者需保证期间没有Append，返回后再在锁外调用WriteSnapshot
+  bool Rotate();
+
+  /// @brief 写入快照，entries需是Rotate时的全部条目，成功后删除旧日志
+  bool WriteSnapshot(const std::vector<Record>& entries);
+
+ private:
+  static void Encode(const Record& record, std::string* to);
+
+  /// @brief 解码一条记录，成功则from前移
+  static bool Decode(std::string_view* from, Record* record);
+
+  /// @brief 读取文件并回放记录，返回有效部分的长度，文件不存在返回空
+  static std::optional<std::size_t> ReplayFile(const std::string& path,
+                                               std::vector<Record>* records);
+
+  std::string GetPath(std::string_view name) const;
+
+  /// @brief 打开日志，需持有file_mutex_
+  bool UnsafeOpen();
+
+  /// @brief 写出缓冲区，需持有file_mutex_
+  void UnsafeFlush();
+
+ private:
+  const std::string dir_;
+  std::mutex file_mutex_;    // 写出、换用日志时持有，保证缓冲区按追加的顺序写出
+  int fd_ = -1;
+  std::mutex buffer_mutex_;  // 只在读写缓冲区时短暂持有
+  std::string buffer_;
+  std::atomic<std::size_t> pending_records_{};
+};
+
+} // namespace distribuild::cache
@@ -0,0 +1,37 @@
+#include <grpc/grpc.h>
+#include <grpcpp/server_builder.h>
+#include <gflags/gflags.h>
+#include "common/waiter.h"
+#include "cache/cache_service_impl.h"
+
+DEFINE_string(service_uri, "0.0.0.0:10015", "缓存服务器监听地址");
+
+namespace distribuild::cache {
+
+int StartCacheServer(int argc, char** argv) {
+  LOG_INFO("server地址：{}", FLAGS_service_uri);
+
+  // 创建grcp server
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(FLAGS_service_uri, grpc::InsecureServerCredentials());
+  CacheServiceImpl grcp_service;
+  builder.RegisterService(&grcp_service);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+
+  // 等待退出
+  TerminationWaiter waiter;
+  waiter.run(argc, argv);
+
+  // 等待服务器处理请求
+  grcp_service.Stop();
+  server->Shutdown();
+
+  return 0;
+}
+
+} // namespace distribuild::cache
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  return distribuild::cache::StartCacheServer(argc, argv);
+}
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include <cstring>
+#include "cache/memory_cache.h"
+#include "common/spdlogging.h"
+#include "common/hash.h"
+
+namespace distribuild::cache {
+
+MemoryCache::MemoryCache(std::size_t max_size)
+  : shard_max_size_(max_size / kShards)
+  , allocator_(SlabAllocator::Create(max_size / 8)) {
+  LOG_INFO("内存缓存大小上限：{} 字节，分片数：{}", max_size, kShards);
+}
+
+std::vector<std::string> MemoryCache::GetKeys() {
+  std::vector<std::string> result;
+  for (auto&& shard : shards_) {
+    std::scoped_lock lock(shard.mutex);
+    for (auto&& [k, _] : shard.entries) {
+      result.push_back(k);
+    }
+  }
+  return result;
+}
+
+std::optional<Buffer> MemoryCache::TryGet(const std::string& key) {
+  auto&& shard = GetShard(key);
+  std::scoped_lock lock(shard.mutex);
+  auto iter = shard.entries.find(key);
+  if (iter == shard.entries.end()) {
+    return std::nullopt;
+  }
+
+  auto entry = iter->second;
+  if (entry->is_protected) {
+    shard.protected_.splice(shard.protected_.begin(), shard.protected_, entry);
+  } else {
+    // 再次命中，从试用区晋升到保护区
+    entry->is_protected = true;
+    shard.probation_size -= entry->block_size;
+    shard.protected_size += entry->block_size;
+    shard.protected_.splice(shard.protected_.begin(), shard.probation, entry);
+
+    // 保护区超出比例，降级最久未使用的条目回试用区
+    while (shard.protected_size > shard_max_size_ * kProtectedPercent / 100 &&
+           shard.protected_.size() > 1) {
+      auto demoted = std::prev(shard.protected_.end());
+      demoted->is_protected = false;
+      shard.protected_size -= demoted->block_size;
+      shard.probation_size += demoted->block_size;
+      shard.probation.splice(shard.probation.begin(), shard.protected_, demoted);
+    }
+  }
+
+  return Buffer(entry->block, entry->block.get(), entry->size);
+}
+
+void MemoryCache::Put(const std::string& key, std::string_view bytes, std::uint32_t cost_ms) {
+  auto block_size = SlabAllocator::GetBlockSize(bytes.size());
+  if (block_size > shard_max_size_) {
+    return; // 太大，不缓存
+  }
+
+  // 在锁外分配与复制
+  auto block = allocator_->Allocate(bytes.size());
+  memcpy(block.get(), bytes.data(), bytes.size());
+
+  auto&& shard = GetShard(key);
+  std::scoped_lock lock(shard.mutex);
+  if (auto iter = shard.entries.find(key); iter != shard.entries.end()) {
+    UnsafeErase(shard, iter->second);
+  }
+  shard.probation.push_front(Entry{
+    .key          = key,
+    .block        = std::move(block),
+    .size         = bytes.size(),
+    .block_size   = block_size,
+    .is_protected = false,
+  });
+  shard.probation_size += block_size;
+  shard.entries[key] = shard.probation.begin();
+  Notify(key, true);
+  UnsafeEvict(shard);
+}
+
+std::optional<std::string> MemoryCache::GetEvictionCandidate(const std::string& key) {
+  auto&& shard = GetShard(key);
+  std::scoped_lock lock(shard.mutex);
+  if ((shard.probation_size + shard.protected_size) * 100 < shard_max_size_ * kAdmissionPercent) {
+    return std::nullopt;
+  }
+  auto&& list = shard.probation.empty() ? shard.protected_ : shard.probation;
+  if (list.empty()) {
+    return std::nullopt;
+  }
+  return list.back().key;
+}
+
+void MemoryCache::Purge() {
+  std::size_t purged = 0;
+  for (auto&& shard : shards_) {
+    std::scoped_lock lock(shard.mutex);
+    purged += UnsafeEvict(shard);
+  }
+  if (purged) {
+    LOG_DEBUG("内存缓存淘汰了 {} 个条目", purged);
+  }
+}
+
+MemoryCache::Shard& MemoryCache::GetShard(const std::string& key) {
+  return shards_[Hash64(key) % kShards];
+}
+
+std::size_t MemoryCache::UnsafeEvict(Shard& shard) {
+  std::size_t evicted = 0;
+  // 先淘汰试用区，再淘汰保护区
+  while (shard.probation_size + shard.protected_size > shard_max_size_) {
+    auto&& list = shard.probation.empty() ? shard.protected_ : shard.probation;
+    UnsafeErase(shard, std::prev(list.end()));
+    ++evicted;
+  }
+  return evicted;
+}
+
+void MemoryCache::UnsafeErase(Shard& shard, EntryList::iterator iter) {
+  // 正在被读取的块在Buffer释放后才回到内存池
+  Notify(iter->key, false);
+  shard.entries.erase(iter->key);
+  if (iter->is_protected) {
+    shard.protected_size -= iter->block_size;
+    shard.protected_.erase(iter);
+  } else {
+    shard.probation_size -= iter->block_size;
+    shard.probation.erase(iter);
+  }
+}
+
+} // namespace distribuild::cache
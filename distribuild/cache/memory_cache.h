@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "cache/cache_engine.h"
+#include "cache/slab_allocator.h"
+
+namespace distribuild::cache {
+
+/// @brief 内存缓存，作为L1缓存
+/// 条目内存来自SlabAllocator，读取时返回共享的Buffer而不复制；
+/// 按key哈希分为多个分片，每个分片使用分段LRU（试用区+保护区）淘汰，
+/// 只被访问过一次的条目不会挤掉反复命中的条目
+class MemoryCache : public CacheEngine {
+ public:
+  /// @param max_size 允许占用的最大字节数
+  explicit MemoryCache(std::size_t max_size);
+
+  std::vector<std::string> GetKeys() override;
+  std::optional<Buffer> TryGet(const std::string& key) override;
+  void Put(const std::string& key, std::string_view bytes, std::uint32_t cost_ms) override;
+  void Purge() override;
+
+  /// @brief key所在分片将满时返回该分片最先淘汰的条目
+  std::optional<std::string> GetEvictionCandidate(const std::string& key) override;
+
+ private:
+  static constexpr std::size_t kShards = 16;
+  static constexpr std::size_t kProtectedPercent = 80; // 保护区占分片容量的比例
+  static constexpr std::size_t kAdmissionPercent = 95; // 分片占用超过该比例时新条目需要通过准入
+
+  struct Entry {
+    std::string key;
+    std::shared_ptr<char> block;
+    std::size_t size;        // 数据大小
+    std::size_t block_size;  // 占用大小
+    bool is_protected;
+  };
+  using EntryList = std::list<Entry>;
+
+  struct Shard {
+    std::mutex mutex;
+    EntryList probation;                // 试用区，新条目放入
+    EntryList protected_;               // 保护区，试用区中再次命中的条目放入
+    std::size_t probation_size = 0;
+    std::size_t protected_size = 0;
+    std::unordered_map<std::string, EntryList::iterator> entries;
+  };
+
+  Shard& GetShard(const std::string& key);
+
+  /// @brief 淘汰直到不超过容量，需持有分片锁
+  std::size_t UnsafeEvict(Shard& shard);
+
+  /// @brief 移除条目，需持有分片锁
+  void UnsafeErase(Shard& shard, EntryList::iterator iter);
+
+ private:
+  const std::size_t shard_max_size_;
+  std::shared_ptr<SlabAllocator> allocator_;
+  std::array<Shard, kShards> shards_;
+};
+
+} // namespace distribuild::cache
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include "cache/slab_allocator.h"
+
+namespace distribuild::cache {
+
+namespace {
+
+/// @brief 各级块大小：1K ~ 1G，每翻一倍分4级，浪费不超过25%
+const std::vector<std::size_t> kClassSizes = [] {
+  std::vector<std::size_t> result;
+  for (std::size_t base = 1024; base < (std::size_t(1) << 30); base *= 2) {
+    for (std::size_t i = 0; i < 4; ++i) {
+      result.push_back(base + base / 4 * i);
+    }
+  }
+  result.push_back(std::size_t(1) << 30);
+  return result;
+}();
+
+} // namespace
+
+std::shared_ptr<SlabAllocator> SlabAllocator::Create(std::size_t max_idle_size) {
+  return std::shared_ptr<SlabAllocator>(new SlabAllocator(max_idle_size));
+}
+
+SlabAllocator::SlabAllocator(std::size_t max_idle_size)
+  : max_idle_size_(max_idle_size)
+  , free_lists_(kClassSizes.size()) {}
+
+SlabAllocator::~SlabAllocator() {
+  for (auto&& free_list : free_lists_) {
+    for (auto&& block : free_list) {
+      delete[] block;
+    }
+  }
+}
+
+std::shared_ptr<char> SlabAllocator::Allocate(std::size_t size) {
+  auto size_class = GetClass(size);
+  char* block = nullptr;
+
+  if (size_class >= 0) {
+    std::scoped_lock lock(mutex_);
+    auto&& free_list = free_lists_[size_class];
+    if (!free_list.empty()) {
+      block = free_list.back();
+      free_list.pop_back();
+      idle_size_ -= kClassSizes[size_class];
+    }
+  }
+  if (!block) {
+    block = new char[GetBlockSize(size)];
+  }
+
+  return std::shared_ptr<char>(block, [self = shared_from_this(), size_class](char* p) {
+    self->Release(p, size_class);
+  });
+}
+
+std::size_t SlabAllocator::GetBlockSize(std::size_t size) {
+  auto size_class = GetClass(size);
+  return size_class >= 0 ? kClassSizes[size_class] : size;
+}
+
+int SlabAllocator::GetClass(std::size_t size) {
+  auto iter = std::lower_bound(kClassSizes.begin(), kClassSizes.end(), size);
+  return iter == kClassSizes.end() ? -1 : iter - kClassSizes.begin();
+}
+
+void SlabAllocator::Release(char* block, int size_class) {
+  if (size_class >= 0) {
+    std::scoped_lock lock(mutex_);
+    if (idle_size_ + kClassSizes[size_class] <= max_idle_size_) {
+      free_lists_[size_class].push_back(block);
+      idle_size_ += kClassSizes[size_class];
+      return;
+    }
+  }
+  delete[] block;
+}
+
+} // namespace distribuild::cache
@@ -0,0 +1,38 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace distribuild::cache {
+
+/// @brief 按大小分级的内存池
+/// 块大小每翻一倍分为4级，释放的块放回所属级别的空闲链表复用，减少反复向系统申请大块内存
+class SlabAllocator : public std::enable_shared_from_this<SlabAllocator> {
+ public:
+  /// @param max_idle_size 空闲链表最多保留的字节数，超出则直接归还系统
+  static std::shared_ptr<SlabAllocator> Create(std::size_t max_idle_size);
+
+  ~SlabAllocator();
+
+  /// @brief 分配至少size字节的块，引用全部释放后块自动回到内存池
+  std::shared_ptr<char> Allocate(std::size_t size);
+
+  /// @brief 实际分配的块大小
+  static std::size_t GetBlockSize(std::size_t size);
+
+ private:
+  explicit SlabAllocator(std::size_t max_idle_size);
+
+  /// @brief 获取大小所属的级别，超出最大级别返回-1
+  static int GetClass(std::size_t size);
+
+  void Release(char* block, int size_class);
+
+ private:
+  const std::size_t max_idle_size_;
+  std::mutex mutex_;
+  std::size_t idle_size_ = 0;
+  std::vector<std::vector<char*>> free_lists_;
+};
+
+} // namespace distribuild::cache
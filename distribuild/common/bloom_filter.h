@@ -0,0 +1,313 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "common/hash.h"
+#include "common/crypto/zstd.h"
+
+namespace distribuild {
+
+/// @brief 分块布隆过滤器
+/// 每个key只落在一个512位（一个缓存行）的块内，一次查询只访问一个缓存行；
+/// 块内按位与比较，x86-64上运行时检测到AVX2则用两条`vptest`完成，不依赖编译选项
+class BlockedBloomFilter {
+ public:
+  static constexpr std::size_t kBlockBits = 512;
+  static constexpr std::size_t kBlockWords = kBlockBits / 64;
+  static constexpr std::uint32_t kMaxHashes = 16;
+  static constexpr std::size_t kMaxBlocks = 1 << 24; // 1G位图
+
+  struct alignas(64) Block {
+    std::uint64_t words[kBlockWords];
+  };
+
+  BlockedBloomFilter() = default;
+
+  /// @param num_blocks 块数
+  /// @param num_hashes 每个key设置的位数
+  BlockedBloomFilter(std::size_t num_blocks, std::uint32_t num_hashes)
+    : num_hashes_(std::min(std::max(num_hashes, 1u), kMaxHashes))
+    , blocks_(std::max<std::size_t>(num_blocks, 1), Block{}) {}
+
+  /// @brief 按预期key数量创建，每个key约占bits_per_key位
+  static BlockedBloomFilter ForCapacity(std::size_t expected_keys, std::size_t bits_per_key = 12) {
+    auto num_blocks = (std::max<std::size_t>(expected_keys, 1) * bits_per_key + kBlockBits - 1) / kBlockBits;
+    // 最优哈希数约为 bits_per_key * ln2
+    return BlockedBloomFilter(num_blocks, static_cast<std::uint32_t>(bits_per_key * 69 / 100));
+  }
+
+  /// @brief 从GetBytes()的结果恢复
+  static std::optional<BlockedBloomFilter> FromBytes(std::string_view bytes, std::uint32_t num_hashes) {
+    if (bytes.empty() || bytes.size() % sizeof(Block) != 0 || num_hashes == 0 || num_hashes > kMaxHashes) {
+      return std::nullopt;
+    }
+    BlockedBloomFilter result(bytes.size() / sizeof(Block), num_hashes);
+    memcpy(result.blocks_.data(), bytes.data(), bytes.size());
+    return result;
+  }
+
+  void Add(std::string_view key) { AddHash(Hash64(key)); }
+
+  void AddHash(std::uint64_t hash) {
+    if (blocks_.empty()) {
+      return;
+    }
+    auto&& block = blocks_[GetBlockIndex(hash)];
+    auto mask = MakeMask(hash);
+    for (std::size_t i = 0; i < kBlockWords; ++i) {
+      block.words[i] |= mask.words[i];
+    }
+  }
+
+  bool PossiblyContains(std::string_view key) const { return PossiblyContainsHash(Hash64(key)); }
+
+  bool PossiblyContainsHash(std::uint64_t hash) const {
+    if (blocks_.empty()) {
+      return false;
+    }
+    auto&& block = blocks_[GetBlockIndex(hash)];
+    auto mask = MakeMask(hash);
+#if defined(__AVX2__)
+    return ContainsMaskAvx2(block, mask);
+#elif defined(__x86_64__)
+    return kHasAvx2 ? ContainsMaskAvx2(block, mask) : ContainsMask(block, mask);
+#else
+    return ContainsMask(block, mask);
+#endif
+  }
+
+  /// @brief 原始位图
+  std::string_view GetBytes() const {
+    return {reinterpret_cast<const char*>(blocks_.data()), blocks_.size() * sizeof(Block)};
+  }
+
+  /// @brief 序列化为 头部（版本、参数） + zstd压缩的位图，用于网络传输
+  std::string Serialize() const {
+    SerializedHeader header{
+      .magic      = kMagic,
+      .version    = kVersion,
+      .num_hashes = static_cast<std::uint16_t>(num_hashes_),
+      .num_blocks = blocks_.size(),
+    };
+    auto compressed = ZSTDCompress(GetBytes());
+    if (!compressed) {
+      return {};
+    }
+    std::string result(reinterpret_cast<const char*>(&header), sizeof(header));
+    result.append(*compressed);
+    return result;
+  }
+
+  /// @brief 从Serialize()的结果恢复
+  static std::optional<BlockedBloomFilter> Deserialize(std::string_view bytes) {
+    SerializedHeader header;
+    if (bytes.size() < sizeof(header)) {
+      return std::nullopt;
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kMagic || header.version != kVersion || header.num_blocks > kMaxBlocks) {
+      return std::nullopt;
+    }
+    auto bitmap = ZSTDDecompress(bytes.substr(sizeof(header)));
+    if (!bitmap || bitmap->size() != header.num_blocks * sizeof(Block)) {
+      return std::nullopt;
+    }
+    return FromBytes(*bitmap, header.num_hashes);
+  }
+
+  std::uint32_t GetNumHashes() const noexcept { return num_hashes_; }
+  std::size_t GetNumBlocks() const noexcept { return blocks_.size(); }
+
+ private:
+  friend class CountingBloomFilter;
+
+#if defined(__x86_64__) && !defined(__AVX2__)
+  /// @brief 运行时检测，未用-mavx2编译时同样可以使用AVX2
+  static inline const bool kHasAvx2 = [] {
+    __builtin_cpu_init(); // 可能早于libgcc的初始化执行
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+#endif
+
+  /// @brief block是否包含mask中所有的位
+  static bool ContainsMask(const Block& block, const Block& mask) {
+    std::uint64_t missing = 0;
+    for (std::size_t i = 0; i < kBlockWords; ++i) {
+      missing |= mask.words[i] & ~block.words[i];
+    }
+    return missing == 0;
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("avx2")))
+  static bool ContainsMaskAvx2(const Block& block, const Block& mask) {
+    auto b0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(block.words));
+    auto b1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(block.words + 4));
+    auto m0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(mask.words));
+    auto m1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(mask.words + 4));
+    return _mm256_testc_si256(b0, m0) && _mm256_testc_si256(b1, m1);
+  }
+#endif
+
+  static constexpr std::uint32_t kMagic = 0x46424244; // "DBBF"
+  static constexpr std::uint16_t kVersion = 1;
+
+  /// @brief 序列化头部，小端
+  struct SerializedHeader {
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t num_hashes;
+    std::uint64_t num_blocks;
+  };
+
+  std::size_t GetBlockIndex(std::uint64_t hash) const {
+    // 用高32位映射到[0, num_blocks)，避免取模
+    return static_cast<std::size_t>(((hash >> 32) * blocks_.size()) >> 32);
+  }
+
+  /// @brief 块内要设置的位
+  Block MakeMask(std::uint64_t hash) const {
+    Block mask{};
+    auto bits = hash * 0x9e3779b97f4a7c15ULL; // 与块号使用的高位区分开
+    for (std::uint32_t i = 0; i < num_hashes_; ++i) {
+      if (i != 0 && i % 7 == 0) {
+        bits = Hash64(std::string_view(reinterpret_cast<const char*>(&bits), sizeof(bits)));
+      }
+      auto bit = (bits >> (9 * (i % 7))) & (kBlockBits - 1);
+      mask.words[bit / 64] |= std::uint64_t(1) << (bit % 64);
+    }
+    return mask;
+  }
+
+ private:
+  std::uint32_t num_hashes_ = 0;
+  std::vector<Block> blocks_;
+};
+
+/// @brief 计数布隆过滤器，支持删除
+/// 布局与BlockedBloomFilter相同，每一位对应一个4位计数器，同时维护对应的位图用于查询；
+/// 计数器饱和后不再变化
+class CountingBloomFilter {
+ public:
+  CountingBloomFilter() = default;
+
+  CountingBloomFilter(std::size_t num_blocks, std::uint32_t num_hashes)
+    : bits_(num_blocks, num_hashes)
+    , counters_(bits_.GetNumBlocks() * kBlockCounterBytes) {}
+
+  /// @brief 按预期key数量创建，参数与BlockedBloomFilter::ForCapacity相同
+  static CountingBloomFilter ForCapacity(std::size_t expected_keys, std::size_t bits_per_key = 12) {
+    auto bits = BlockedBloomFilter::ForCapacity(expected_keys, bits_per_key);
+    return CountingBloomFilter(bits.GetNumBlocks(), bits.GetNumHashes());
+  }
+
+  void Add(std::string_view key) { AddHash(Hash64(key)); }
+  void AddHash(std::uint64_t hash) { Update(hash, true); }
+
+  /// @brief 只能删除加入过的key，否则会影响其他key
+  void Remove(std::string_view key) { RemoveHash(Hash64(key)); }
+  void RemoveHash(std::uint64_t hash) { Update(hash, false); }
+
+  bool PossiblyContains(std::string_view key) const { return bits_.PossiblyContains(key); }
+  bool PossiblyContainsHash(std::uint64_t hash) const { return bits_.PossiblyContainsHash(hash); }
+
+  /// @brief 计数器非零的位
+  const BlockedBloomFilter& GetBits() const noexcept { return bits_; }
+
+  /// @brief 序列化为 头部（版本、参数） + zstd压缩的计数器
+  std::string Serialize() const {
+    BlockedBloomFilter::SerializedHeader header{
+      .magic      = kMagic,
+      .version    = kVersion,
+      .num_hashes = static_cast<std::uint16_t>(bits_.GetNumHashes()),
+      .num_blocks = bits_.GetNumBlocks(),
+    };
+    auto compressed = ZSTDCompress({reinterpret_cast<const char*>(counters_.data()), counters_.size()});
+    if (!compressed) {
+      return {};
+    }
+    std::string result(reinterpret_cast<const char*>(&header), sizeof(header));
+    result.append(*compressed);
+    return result;
+  }
+
+  /// @brief 从Serialize()的结果恢复，位图由计数器重新生成
+  static std::optional<CountingBloomFilter> Deserialize(std::string_view bytes) {
+    BlockedBloomFilter::SerializedHeader header;
+    if (bytes.size() < sizeof(header)) {
+      return std::nullopt;
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kMagic || header.version != kVersion ||
+        header.num_blocks == 0 || header.num_blocks > BlockedBloomFilter::kMaxBlocks ||
+        header.num_hashes == 0 || header.num_hashes > BlockedBloomFilter::kMaxHashes) {
+      return std::nullopt;
+    }
+    auto counters = ZSTDDecompress(bytes.substr(sizeof(header)));
+    if (!counters || counters->size() != header.num_blocks * kBlockCounterBytes) {
+      return std::nullopt;
+    }
+
+    CountingBloomFilter result(header.num_blocks, header.num_hashes);
+    memcpy(result.counters_.data(), counters->data(), counters->size());
+    for (std::size_t i = 0; i < result.counters_.size(); ++i) {
+      auto&& block = result.bits_.blocks_[i / kBlockCounterBytes];
+      auto bit = i % kBlockCounterBytes * 2;
+      if (result.counters_[i] & 0x0f) {
+        block.words[bit / 64] |= std::uint64_t(1) << (bit % 64);
+      }
+      if (result.counters_[i] & 0xf0) {
+        block.words[bit / 64] |= std::uint64_t(1) << (bit % 64 + 1);
+      }
+    }
+    return result;
+  }
+
+ private:
+  static constexpr std::uint32_t kMagic = 0x46424344; // "DCBF"
+  static constexpr std::uint16_t kVersion = 1;
+  static constexpr std::size_t kBlockCounterBytes = BlockedBloomFilter::kBlockBits / 2; // 每字节两个计数器
+  static constexpr std::uint8_t kMaxCount = 0x0f;
+
+  void Update(std::uint64_t hash, bool add) {
+    if (counters_.empty()) {
+      return;
+    }
+    auto index = bits_.GetBlockIndex(hash);
+    auto mask = bits_.MakeMask(hash);
+    auto&& block = bits_.blocks_[index];
+    auto counters = counters_.data() + index * kBlockCounterBytes;
+
+    for (std::size_t word = 0; word < BlockedBloomFilter::kBlockWords; ++word) {
+      for (auto pending = mask.words[word]; pending; pending &= pending - 1) {
+        auto bit = word * 64 + std::countr_zero(pending);
+        auto shift = bit % 2 * 4;
+        std::uint8_t count = (counters[bit / 2] >> shift) & 0x0f;
+        if (count == kMaxCount || (!add && count == 0)) {
+          continue; // 饱和的计数器不再变化
+        }
+        count += add ? 1 : -1;
+        counters[bit / 2] = (counters[bit / 2] & ~(0x0f << shift)) | (count << shift);
+        if (count) {
+          block.words[word] |= std::uint64_t(1) << (bit % 64);
+        } else {
+          block.words[word] &= ~(std::uint64_t(1) << (bit % 64));
+        }
+      }
+    }
+  }
+
+ private:
+  BlockedBloomFilter bits_;
+  std::vector<std::uint8_t> counters_;
+};
+
+} // namespace distribuild
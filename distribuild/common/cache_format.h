@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "common/crypto/blake3.h"
+#include "../build/distribuild/proto/cache.pb.h"
+
+namespace distribuild {
+
+// 格式v2（未压缩，文件本身已是zstd压缩，不再整体压缩一遍）：
+// CacheHeaderV2 | CacheMeta | CacheFileEntry * file_count | 文件名 | 文件内容
+// files_check_hash为文件表、文件名与文件内容的Blake3，可以在原数据上校验并取出单个文件
+
+constexpr char kCacheMagic[4] = {'D', 'B', 'C', 'E'};
+constexpr std::uint16_t kCacheVersion = 2;
+
+struct CacheHeaderV2 {
+  char magic[4];
+  std::uint16_t version;
+  std::uint16_t file_count;
+  std::uint32_t meta_size;
+} __attribute__((packed));
+
+struct CacheFileEntry {
+  std::uint64_t offset;   // 相对文件内容起始位置
+  std::uint64_t size;
+  std::uint32_t name_size;
+} __attribute__((packed));
+
+/// @brief 解析后的条目，files指向原数据，调用者需保证原数据的生命周期
+struct CacheEntryView {
+  cache::CacheMeta meta;
+  std::vector<std::pair<std::string_view, std::string_view>> files;
+};
+
+/// @brief 解析v2条目，不复制文件内容
+/// @param check_hash 是否校验文件内容，只需要文件位置时（如查看使用的字典）可以跳过，不必读取整个条目
+inline std::optional<CacheEntryView> TryParseCacheEntryView(std::string_view data, bool check_hash = true) {
+  CacheHeaderV2 header;
+  if (data.size() < sizeof(header)) {
+	return std::nullopt;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 || header.version != kCacheVersion) {
+	return std::nullopt;
+  }
+  data.remove_prefix(sizeof(header));
+  // meta
+  CacheEntryView result;
+  if (data.size() < header.meta_size ||
+      !result.meta.ParseFromArray(data.data(), header.meta_size)) {
+	return std::nullopt;
+  }
+  data.remove_prefix(header.meta_size);
+  // 校验文件表、文件名与文件内容
+  if (check_hash && result.meta.files_check_hash() != Blake3(data)) {
+	return std::nullopt;
+  }
+  // 文件表
+  std::size_t table_size = header.file_count * sizeof(CacheFileEntry);
+  if (data.size() < table_size) {
+	return std::nullopt;
+  }
+  auto table = data.substr(0, table_size);
+  std::size_t names_size = 0;
+  for (std::size_t i = 0; i < header.file_count; ++i) {
+	CacheFileEntry file;
+	memcpy(&file, table.data() + i * sizeof(file), sizeof(file));
+	names_size += file.name_size;
+  }
+  if (data.size() - table_size < names_size) {
+	return std::nullopt;
+  }
+  auto names = data.substr(table_size, names_size);
+  auto contents = data.substr(table_size + names_size);
+  // 文件
+  std::size_t name_offset = 0;
+  for (std::size_t i = 0; i < header.file_count; ++i) {
+	CacheFileEntry file;
+	memcpy(&file, table.data() + i * sizeof(file), sizeof(file));
+	if (file.offset > contents.size() || contents.size() - file.offset < file.size) {
+	  return std::nullopt;
+	}
+	result.files.emplace_back(names.substr(name_offset, file.name_size),
+	                          contents.substr(file.offset, file.size));
+	name_offset += file.name_size;
+  }
+  return result;
+}
+
+} // namespace distribuild
@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+#include "common/hash.h"
+
+namespace distribuild {
+
+/// @brief 一致性哈希环，每个节点在环上有多个虚拟节点，增减节点时只有约1/N的key换到其他节点
+/// 哈希使用Hash64，不同进程按相同的节点列表得到相同的结果
+class ConsistentHashRing {
+ public:
+  /// @param nodes 节点名（如地址），下标即节点编号
+  /// @param virtual_nodes 每个节点的虚拟节点数
+  ConsistentHashRing(const std::vector<std::string>& nodes, std::size_t virtual_nodes)
+    : num_nodes_(nodes.size()) {
+    ring_.reserve(nodes.size() * virtual_nodes);
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+      for (std::size_t j = 0; j < virtual_nodes; ++j) {
+        ring_.emplace_back(Hash64(fmt::format("{}#{}", nodes[i], j)), i);
+      }
+    }
+    std::sort(ring_.begin(), ring_.end());
+  }
+
+  std::size_t GetNumNodes() const noexcept { return num_nodes_; }
+
+  /// @brief 从key的位置顺时针找到的前count个不同节点，第一个是主节点，之后是副本
+  std::vector<std::size_t> GetNodes(std::string_view key, std::size_t count) const {
+    std::vector<std::size_t> result;
+    count = std::min(count, num_nodes_);
+    if (ring_.empty()) {
+      return result;
+    }
+    auto start = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(Hash64(key), std::size_t(0)));
+    for (std::size_t i = 0; i < ring_.size() && result.size() < count; ++i) {
+      auto node = ring_[(start - ring_.begin() + i) % ring_.size()].second;
+      if (std::find(result.begin(), result.end(), node) == result.end()) {
+        result.push_back(node);
+      }
+    }
+    return result;
+  }
+
+ private:
+  std::size_t num_nodes_;
+  std::vector<std::pair<std::uint64_t, std::size_t>> ring_; // (虚拟节点哈希, 节点编号)，按哈希排序
+};
+
+} // namespace distribuild
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+namespace distribuild {
+
+/// @brief 64位哈希（FNV-1a + splitmix64混合），结果跨进程、跨机器稳定，
+/// 可用于磁盘分片路径与在网络上传输的布隆过滤器
+inline std::uint64_t Hash64(std::string_view data) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto&& c : data) {
+    hash ^= static_cast<std::uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+} // namespace distribuild
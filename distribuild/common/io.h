@@ -1,8 +1,11 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <optional>
 #include <chrono>
 #include <unistd.h>
 #include <fstream>
+#include <sstream>
 #include <fcntl.h>
 #include <poll.h>
 #include <algorithm>
@@ -33,6 +36,51 @@ inline std::ptrdiff_t ReadTo(int fd, char* data, std::size_t bytes) {
   }
 }
 
+/// @brief 写入全部数据，出错或fd不可写时返回false
+inline bool WriteFully(int fd, std::string_view data) {
+  std::size_t written = 0;
+  while (written < data.size()) {
+    auto result = WriteTo(fd, data, written);
+    if (result <= 0) {
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+/// @brief 读取整个文件，无法打开时返回std::nullopt
+inline std::optional<std::string> ReadFile(const std::string& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    return std::nullopt;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+/// @brief 读取文件开头的size字节，无法打开或不足size字节时返回std::nullopt
+inline std::optional<std::string> ReadFile(const std::string& path, std::size_t size) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  std::string result(size, '\0');
+  std::size_t bytes_read = 0;
+  while (bytes_read < size) {
+    auto n = ReadTo(fd, result.data() + bytes_read, size - bytes_read);
+    if (n <= 0) {
+      break;
+    }
+    bytes_read += n;
+  }
+  close(fd);
+  if (bytes_read != size) {
+    return std::nullopt;
+  }
+  return result;
+}
 
 inline void WriteAll(const std::string& filename, const std::string_view& data) {
   LOG_DEBUG("写入文件 {}", filename);
@@ -114,6 +114,32 @@ inline std::string EscapeCommandArgument(const std::string_view &str) {
 
 // ============================================================================= //
 
+/// @brief 解析出字节数（1G、1M、1K）
+/// @param size_str_view 
+/// @return 
+inline std::size_t ParseMemorySize(const std::string_view& size_str_view) {
+  std::string size_str(size_str_view);
+  std::uint64_t scale = 1;
+
+  if (size_str.back() == 'G') {
+    scale = 1 << 30;
+    size_str.pop_back();
+  } else if (size_str.back() == 'M') {
+    scale = 1 << 20;
+    size_str.pop_back();
+  } else if (size_str.back() == 'K') {
+    scale = 1 << 10;
+    size_str.pop_back();
+  } else if (size_str.back() == 'B') {
+    size_str.pop_back();
+  }
+  // 默认为字节数
+
+  return std::stoul(size_str) * scale;
+}
+
+// ============================================================================= //
+
 inline void SetTimeout(grpc::ClientContext* context, const std::chrono::seconds& sec) {
   auto deadline = gpr_time_add(
     gpr_now(GPR_CLOCK_REALTIME),
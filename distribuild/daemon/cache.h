@@ -1,6 +1,11 @@
 #pragma once
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <vector>
+#include "common/tools.h"
+#include "common/cache_format.h"
 #include "common/crypto/blake3.h"
 #include "common/crypto/zstd.h"
 #include "google/protobuf/any.pb.h"
@@ -13,9 +18,11 @@ struct CacheEntry {
   std::string std_out;
   std::string std_err;
   google::protobuf::Any extra_info;
-  std::string packed;
+  std::vector<std::pair<std::string, std::string>> files; // 扩展名 -> zstd压缩后的文件
+  std::uint32_t compile_cost_ms = 0; // 编译耗时，0表示未知
 };
 
+/// @brief 格式v1：zstd(CacheHeader | CacheMeta | PackFiles)，只用于读取旧条目
 struct CacheHeader {
   uint64_t packed_size;
   uint32_t meta_size;
@@ -23,36 +30,65 @@ struct CacheHeader {
 };
 
 inline std::optional<std::string> TryMakeCacheData(CacheEntry&& entry) {
+  if (entry.files.size() > UINT16_MAX) {
+	return std::nullopt;
+  }
+  // 文件表、文件名、文件内容
+  std::string table;
+  std::string names;
+  std::size_t files_size = 0;
+  for (auto&& [name, content] : entry.files) {
+	CacheFileEntry file {
+	  .offset = files_size,
+	  .size = content.size(),
+	  .name_size = static_cast<std::uint32_t>(name.size()),
+	};
+	table.append(reinterpret_cast<const char*>(&file), sizeof(file));
+	names.append(name);
+	files_size += content.size();
+  }
   // 元数据
   cache::CacheMeta meta;
   meta.set_exit_code(entry.exit_code);
-  meta.set_stdout(entry.std_out);
-  meta.set_stderr(entry.std_err);
-  *meta.mutable_extra_info() = entry.extra_info;
-  meta.set_files_check_hash(Blake3(entry.packed));
+  meta.set_stdout(std::move(entry.std_out));
+  meta.set_stderr(std::move(entry.std_err));
+  *meta.mutable_extra_info() = std::move(entry.extra_info);
+  meta.set_compile_cost_ms(entry.compile_cost_ms);
+  {
+	blake3_hasher state;
+	blake3_hasher_init(&state);
+	blake3_hasher_update(&state, table.data(), table.size());
+	blake3_hasher_update(&state, names.data(), names.size());
+	for (auto&& [_, content] : entry.files) {
+	  blake3_hasher_update(&state, content.data(), content.size());
+	}
+	std::uint8_t output[BLAKE3_OUT_LEN];
+	blake3_hasher_finalize(&state, output, BLAKE3_OUT_LEN);
+	meta.set_files_check_hash(output, BLAKE3_OUT_LEN);
+  }
   auto meta_str = meta.SerializeAsString();
   // header
-  CacheHeader header {
-	.packed_size = entry.packed.size(),
-	.meta_size = (uint32_t)meta_str.size(), // ! metay应该没有这么大吧
+  CacheHeaderV2 header {
+	.version = kCacheVersion,
+	.file_count = static_cast<std::uint16_t>(entry.files.size()),
+	.meta_size = static_cast<std::uint32_t>(meta_str.size()),
   };
-  meta_str.clear();
-  meta_str.shrink_to_fit();
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
   // 构造数据
-  std::string uncompressed;
-  uncompressed.append((char*)&header, sizeof(CacheHeader));
-  uncompressed.append(meta.SerializeAsString());
-  uncompressed.append(entry.packed);
-  // 压缩并返回
-  auto result = ZSTDCompress(uncompressed);
-  if (!result) {
-	return std::nullopt;
-  } else {
-    return std::move(*result);
+  std::string result;
+  result.reserve(sizeof(header) + meta_str.size() + table.size() + names.size() + files_size);
+  result.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  result.append(meta_str);
+  result.append(table);
+  result.append(names);
+  for (auto&& [_, content] : entry.files) {
+	result.append(content);
   }
+  return result;
 }
 
-inline std::optional<CacheEntry> TryParseCacheEntry(std::string&& data) {
+/// @brief 解析v1条目
+inline std::optional<CacheEntry> TryParseCacheEntryV1(const std::string& data) {
   auto decompressed = ZSTDDecompress(data);
   if (!decompressed) {
 	return std::nullopt;
@@ -64,26 +100,57 @@ inline std::optional<CacheEntry> TryParseCacheEntry(std::string&& data) {
   CacheEntry result;
   // header
   CacheHeader header = *(CacheHeader*)decompressed->data();
-  if ((header.meta_size + header.packed_size + sizeof(CacheHeader)) != data.size()) {
+  if ((header.meta_size + header.packed_size + sizeof(CacheHeader)) != decompressed->size()) {
 	return std::nullopt;
   }
   // meta
-  auto meta_str = decompressed->substr(sizeof(CacheHeader), header.meta_size);
   cache::CacheMeta meta;
-  if (!meta.ParseFromString(meta_str)) {
+  if (!meta.ParseFromArray(decompressed->data() + sizeof(CacheHeader), header.meta_size)) {
     return std::nullopt;
   }
-  result.exit_code  = std::move(meta.exit_code());
-  result.std_out    = std::move(meta.stdout());
-  result.std_err    = std::move(meta.stderr());
-  result.extra_info = std::move(meta.extra_info());
   // 文件
-  result.packed = decompressed->substr(sizeof(CacheHeader) + header.meta_size);
+  auto packed = decompressed->substr(sizeof(CacheHeader) + header.meta_size);
   decompressed->clear();
-  if (meta.files_check_hash() != Blake3(result.packed)) {
+  if (meta.files_check_hash() != Blake3(packed)) {
 	return std::nullopt;
   }
+  std::vector<std::pair<std::string, std::string>> files;
+  if (!packed.empty()) {
+	auto unpacked = TryUnpackFiles(packed);
+	if (!unpacked) {
+	  return std::nullopt;
+	}
+	files = std::move(*unpacked);
+  }
+  result.exit_code  = meta.exit_code();
+  result.std_out    = std::move(*meta.mutable_stdout());
+  result.std_err    = std::move(*meta.mutable_stderr());
+  result.extra_info = std::move(*meta.mutable_extra_info());
+  result.compile_cost_ms = meta.compile_cost_ms();
+  result.files = std::move(files);
   return result;
 }
 
-}
\ No newline at end of file
+inline std::optional<CacheEntry> TryParseCacheEntry(std::string&& data) {
+  if (data.size() < sizeof(kCacheMagic) || memcmp(data.data(), kCacheMagic, sizeof(kCacheMagic)) != 0) {
+	return TryParseCacheEntryV1(data);
+  }
+
+  auto view = TryParseCacheEntryView(data);
+  if (!view) {
+	return std::nullopt;
+  }
+  CacheEntry result;
+  result.exit_code  = view->meta.exit_code();
+  result.std_out    = std::move(*view->meta.mutable_stdout());
+  result.std_err    = std::move(*view->meta.mutable_stderr());
+  result.extra_info = std::move(*view->meta.mutable_extra_info());
+  result.compile_cost_ms = view->meta.compile_cost_ms();
+  result.files.reserve(view->files.size());
+  for (auto&& [name, content] : view->files) {
+	result.files.emplace_back(name, content);
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,37 @@
+#include <grpcpp/create_channel.h>
+#include "daemon/cache_cluster.h"
+#include "daemon/config.h"
+#include "common/spdlogging.h"
+#include "common/tools.h"
+
+namespace distribuild::daemon {
+
+CacheCluster* CacheCluster::Instance() {
+  static CacheCluster instance;
+  return &instance;
+}
+
+CacheCluster::CacheCluster() {
+  for (auto&& e : Split(FLAGS_cache_server_location, ',', false)) {
+	locations_.emplace_back(e);
+	auto channel = grpc::CreateChannel(locations_.back(), grpc::InsecureChannelCredentials());
+	stubs_.push_back(cache::CacheService::NewStub(channel));
+	DISTBU_CHECK(stubs_.back());
+  }
+  if (locations_.empty()) {
+	return;
+  }
+  // 环只由地址列表决定，所有daemon配置相同的列表即可得到相同的分片
+  ring_ = std::make_unique<ConsistentHashRing>(locations_, std::max<std::uint32_t>(FLAGS_cache_virtual_nodes, 1));
+  LOG_INFO("缓存集群：{} 个节点，每个条目 {} 个副本", locations_.size(),
+           std::min<std::size_t>(std::max<std::uint32_t>(FLAGS_cache_replicas, 1), locations_.size()));
+}
+
+std::vector<std::size_t> CacheCluster::GetNodes(const std::string& key) const {
+  if (!ring_) {
+	return {};
+  }
+  return ring_->GetNodes(key, std::max<std::uint32_t>(FLAGS_cache_replicas, 1));
+}
+
+} // namespace distribuild::daemon
@@ -0,0 +1,37 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "common/consistent_hash.h"
+#include "../build/distribuild/proto/cache.grpc.pb.h"
+#include "../build/distribuild/proto/cache.pb.h"
+
+namespace distribuild::daemon {
+
+/// @brief 缓存服务器集群，`cache_server_location`中的每个地址是一个节点
+/// 条目按key在一致性哈希环上分片，写入顺时针的前`cache_replicas`个节点，读取时优先主节点
+class CacheCluster {
+ public:
+  static CacheCluster* Instance();
+
+  CacheCluster();
+
+  /// @brief 是否配置了缓存服务器
+  bool IsEnabled() const noexcept { return !stubs_.empty(); }
+
+  std::size_t GetNumNodes() const noexcept { return stubs_.size(); }
+
+  const std::string& GetLocation(std::size_t node) const { return locations_[node]; }
+
+  cache::CacheService::Stub* GetStub(std::size_t node) const { return stubs_[node].get(); }
+
+  /// @brief 保存key的节点，第一个是主节点，之后是副本
+  std::vector<std::size_t> GetNodes(const std::string& key) const;
+
+ private:
+  std::vector<std::string> locations_;
+  std::vector<std::unique_ptr<cache::CacheService::Stub>> stubs_;
+  std::unique_ptr<ConsistentHashRing> ring_;
+};
+
+} // namespace distribuild::daemon
@@ -1,104 +1,259 @@
-#include <grpcpp/create_channel.h>
-#include <Poco/ThreadPool.h>
-#include <Poco/Task.h>
+#include <map>
 #include "daemon/cloud/cache_writer.h"
+#include "daemon/cache_cluster.h"
 #include "daemon/config.h"
 #include "common/spdlogging.h"
 #include "common/tools.h"
 
 namespace distribuild::daemon::cloud {
 
-namespace {
-
-class WriteCacheDataPocoTask : public Poco::Task {
-  cache::CacheService::Stub* stub_;
-  std::string key_;
-  std::string data_;
-  std::promise<bool> promise_;
- public:
-  WriteCacheDataPocoTask(std::future<bool>* future, cache::CacheService::Stub* stub, std::string key, std::string&& data)
-    : Poco::Task("WriteCacheDataPocoTask")
-    , stub_(stub)
-    , key_(key)
-    , data_(std::move(data)) {
-    *future = promise_.get_future();
-  }
-
-  virtual void runTask() override {
-    LOG_DEBUG("开始写入缓存");
-    grpc::ClientContext context;
-	auto* req = new cache::PutEntryRequest;
-    cache::PutEntryResponse resp;
-
-	req->set_key(key_);
-	req->set_token(FLAGS_cache_server_token);
-	SetTimeout(&context, 5s);
-
-	cache::PutEntryRequestChunk chunk;
-	chunk.set_allocated_request(req);
-
-    auto writer = stub_->PutEntry(&context, &resp);
-	if (!writer) {
-	  LOG_ERROR("失败");
-      promise_.set_value(false);
-	}
-	if (!writer->Write(chunk)) {
-      LOG_ERROR("PutEntry写入第一个块失败");
-      promise_.set_value(false);
-    }
-    for (std::size_t i = 0; i < data_.size(); i += FLAGS_chunk_size) {
-  	  chunk.clear_request();
-  	  size_t remaining_size = data_.size() - i;
-  	  chunk.set_file_chunk(data_.data() + i, std::min(FLAGS_chunk_size, remaining_size));
-      if (!writer->Write(chunk)) {
-  	    LOG_ERROR("PutEntry写入文件失败");
-        promise_.set_value(false);
-  	  }
-    }
-	writer->WritesDone();
-    grpc::Status status = writer->Finish();
-    if (!status.ok()) {
-      LOG_WARN("RCP调用`PutEntry`失败：{}", status.error_message());
-      promise_.set_value(false);
-    }
-	promise_.set_value(true);
-  }
-};
-
-} // namespace
-
 CacheWriter* CacheWriter::Instance() {
   static CacheWriter instance;
   return &instance;
 }
 
 CacheWriter::CacheWriter()
-  : task_manager_(Poco::ThreadPool::defaultPool()) {
-  if (FLAGS_cache_server_location.empty()) {
+  : max_queue_size_(ParseMemorySize(FLAGS_cache_writer_max_queue_size)) {
+  if (!CacheCluster::Instance()->IsEnabled()) {
 	return;
   }
-  auto channel = grpc::CreateChannel(FLAGS_cache_server_location, grpc::InsecureChannelCredentials());
-  stub_ = cache::CacheService::NewStub(channel);
-  DISTBU_CHECK(stub_);
+  worker_ = std::thread(&CacheWriter::WorkerProc, this);
 }
 
-CacheWriter::~CacheWriter() {}
+CacheWriter::~CacheWriter() {
+  {
+	std::scoped_lock lock(mutex_);
+	stopping_ = true;
+  }
+  cv_.notify_all();
+  if (worker_.joinable()) {
+	worker_.join();
+  }
+}
 
 std::optional<std::future<bool>> CacheWriter::AsyncWrite(const std::string& key, CacheEntry&& cache_entry) {
-  if (!stub_) {
+  if (!worker_.joinable()) {
 	LOG_DEBUG("缓存未启用");
+	return std::nullopt;
   }
   if (cache_entry.exit_code != 0) {
 	return std::nullopt;
   }
 
-  std::future<bool> result;
+  auto item = std::make_unique<Item>();
+  item->compile_cost_ms = cache_entry.compile_cost_ms;
   auto data = TryMakeCacheData(std::move(cache_entry));
-  if (!data) {
+  if (!data || data->size() > max_queue_size_) {
 	return std::nullopt;
   }
-  task_manager_.start(new WriteCacheDataPocoTask(&result, stub_.get(), key, std::move(*data)));
+  item->key = key;
+  item->data = std::move(*data);
+  item->nodes = CacheCluster::Instance()->GetNodes(key);
+  auto result = item->promise.get_future();
+  {
+	std::scoped_lock lock(mutex_);
+	UnsafePush(std::move(item));
+  }
+  cv_.notify_one();
   return result;
 }
 
-} // namespace distribuild::daemon::cloud
\ No newline at end of file
+void CacheWriter::UnsafePush(std::unique_ptr<Item> item) {
+  std::size_t dropped = 0;
+  while (!queue_.empty() && queue_size_ + item->data.size() > max_queue_size_) {
+	auto&& oldest = queue_.front();
+	queue_size_ -= oldest->data.size();
+	oldest->promise.set_value(oldest->admitted);
+	queue_.pop_front();
+	++dropped;
+  }
+  if (dropped) {
+	LOG_WARN("缓存写入队列已满，丢弃了 {} 个最旧的条目", dropped);
+  }
+  queue_size_ += item->data.size();
+  queue_.push_back(std::move(item));
+}
+
+void CacheWriter::WorkerProc() {
+  while (true) {
+	// 取出所有已到重试时间的条目，总大小不超过kMaxBatchSize；积压越多合并得越多
+	std::vector<std::unique_ptr<Item>> batch;
+	{
+	  std::unique_lock lock(mutex_);
+	  while (!stopping_) {
+		auto now = std::chrono::steady_clock::now();
+		auto earliest = std::chrono::steady_clock::time_point::max();
+		std::size_t batch_size = 0;
+		for (auto iter = queue_.begin(); iter != queue_.end() && batch_size < kMaxBatchSize;) {
+		  if ((*iter)->not_before > now) {
+			earliest = std::min(earliest, (*iter)->not_before);
+			++iter;
+			continue;
+		  }
+		  batch_size += (*iter)->data.size();
+		  queue_size_ -= (*iter)->data.size();
+		  batch.push_back(std::move(*iter));
+		  iter = queue_.erase(iter);
+		}
+		if (!batch.empty()) {
+		  break;
+		}
+		if (earliest == std::chrono::steady_clock::time_point::max()) {
+		  cv_.wait(lock);
+		} else {
+		  cv_.wait_until(lock, earliest);
+		}
+	  }
+	  if (stopping_) {
+		// 退出时丢弃未写入的条目
+		for (auto&& e : batch) {
+		  e->promise.set_value(e->admitted);
+		}
+		for (auto&& e : queue_) {
+		  e->promise.set_value(e->admitted);
+		}
+		queue_.clear();
+		return;
+	  }
+	}
+
+	WriteBatch(batch);
+
+	// 全部写入或重试次数用完的条目完成，其余等待重试
+	auto now = std::chrono::steady_clock::now();
+	std::scoped_lock lock(mutex_);
+	for (auto&& e : batch) {
+	  if (e->nodes.empty() || ++e->attempts >= kMaxAttempts) {
+		if (!e->nodes.empty()) {
+		  LOG_WARN("写入缓存`{}`失败，已重试 {} 次", e->key, e->attempts - 1);
+		}
+		e->promise.set_value(e->admitted);
+		continue;
+	  }
+	  e->not_before = now + kRetryBackoff * (1 << (e->attempts - 1));
+	  UnsafePush(std::move(e));
+	}
+  }
+}
+
+void CacheWriter::WriteBatch(const std::vector<std::unique_ptr<Item>>& batch) {
+  std::map<std::size_t, std::vector<Item*>> node_items;
+  for (auto&& e : batch) {
+	for (auto&& node : e->nodes) {
+	  node_items[node].push_back(e.get());
+	}
+	e->nodes.clear();
+  }
+
+  for (auto&& [node, items] : node_items) {
+	// 大条目单独写入，未通过准入时服务器可以提前结束调用，不必上传整个条目
+	std::vector<Item*> small_items;
+	for (auto&& e : items) {
+	  if (e->data.size() <= kMaxCoalescedEntrySize) {
+		small_items.push_back(e);
+	  } else if (!PutEntry(node, e)) {
+		e->nodes.push_back(node);
+	  }
+	}
+	if (small_items.size() == 1) {
+	  if (!PutEntry(node, small_items.front())) {
+		small_items.front()->nodes.push_back(node);
+	  }
+	} else if (!small_items.empty() && !PutEntries(node, small_items)) {
+	  for (auto&& e : small_items) {
+		e->nodes.push_back(node);
+	  }
+	}
+  }
+}
+
+bool CacheWriter::PutEntry(std::size_t node, Item* item) {
+  auto cluster = CacheCluster::Instance();
+  grpc::ClientContext context;
+  auto* req = new cache::PutEntryRequest;
+  cache::PutEntryResponse resp;
+
+  req->set_key(item->key);
+  req->set_token(FLAGS_cache_server_token);
+  req->set_compile_cost_ms(item->compile_cost_ms);
+  SetTimeout(&context, 5s);
+
+  cache::PutEntryRequestChunk chunk;
+  chunk.set_allocated_request(req);
+
+  auto writer = cluster->GetStub(node)->PutEntry(&context, &resp);
+  // 写入失败说明服务器已经结束调用（如未通过准入），结果以Finish为准
+  bool writable = writer->Write(chunk);
+  for (std::size_t i = 0; writable && i < item->data.size(); i += FLAGS_chunk_size) {
+	chunk.clear_request();
+	chunk.set_file_chunk(item->data.data() + i, std::min<std::size_t>(FLAGS_chunk_size, item->data.size() - i));
+	writable = writer->Write(chunk);
+  }
+  if (writable) {
+	writer->WritesDone();
+  }
+  grpc::Status status = writer->Finish();
+  if (!status.ok()) {
+	LOG_WARN("RCP调用`{}`的`PutEntry`失败：{}", cluster->GetLocation(node), status.error_message());
+	return false;
+  }
+  if (!resp.admitted()) {
+	LOG_DEBUG("缓存服务器`{}`未接受`{}`", cluster->GetLocation(node), item->key);
+  }
+  item->admitted = item->admitted || resp.admitted();
+  return true;
+}
+
+bool CacheWriter::PutEntries(std::size_t node, const std::vector<Item*>& items) {
+  auto cluster = CacheCluster::Instance();
+  grpc::ClientContext context;
+  cache::PutEntriesResponse resp;
+  SetTimeout(&context, 10s);
+
+  auto writer = cluster->GetStub(node)->PutEntries(&context, &resp);
+  cache::PutEntryRequestChunk chunk;
+  bool writable = true;
+  for (std::size_t i = 0; writable && i < items.size(); ++i) {
+	auto* req = new cache::PutEntryRequest;
+	req->set_key(items[i]->key);
+	req->set_token(FLAGS_cache_server_token);
+	req->set_compile_cost_ms(items[i]->compile_cost_ms);
+	chunk.set_allocated_request(req);
+	writable = writer->Write(chunk);
+	chunk.clear_request();
+
+	auto&& data = items[i]->data;
+	for (std::size_t j = 0; writable && j < data.size(); j += FLAGS_chunk_size) {
+	  chunk.set_file_chunk(data.data() + j, std::min<std::size_t>(FLAGS_chunk_size, data.size() - j));
+	  writable = writer->Write(chunk);
+	}
+	chunk.clear_file_chunk();
+  }
+  if (writable) {
+	writer->WritesDone();
+  }
+  grpc::Status status = writer->Finish();
+  if (status.error_code() == grpc::StatusCode::UNIMPLEMENTED) {
+	// 旧版本的缓存服务器，逐个写入
+	for (auto&& e : items) {
+	  if (!PutEntry(node, e)) {
+		e->nodes.push_back(node);
+	  }
+	}
+	return true;
+  }
+  if (!status.ok()) {
+	LOG_WARN("RCP调用`{}`的`PutEntries`失败：{}", cluster->GetLocation(node), status.error_message());
+	return false;
+  }
+  for (auto&& e : resp.admitted_indices()) {
+	if (e < items.size()) {
+	  items[e]->admitted = true;
+	}
+  }
+  LOG_DEBUG("批量写入缓存`{}`：{} 个条目，{} 个被接受", cluster->GetLocation(node), items.size(),
+            resp.admitted_indices_size());
+  return true;
+}
+
+} // namespace distribuild::daemon::cloud
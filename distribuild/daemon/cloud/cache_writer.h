@@ -1,14 +1,20 @@
 #pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <Poco/TaskManager.h>
+#include <thread>
+#include <vector>
 #include "daemon/cache.h"
-#include "../build/distribuild/proto/cache.grpc.pb.h"
-#include "../build/distribuild/proto/cache.pb.h"
 
 namespace distribuild::daemon::cloud {
 
+/// @brief 异步写入缓存
+/// 使用独立的线程与按字节数限制的队列，不与编译任务争抢线程和内存：队列满时丢弃最旧的条目；
+/// 积压的小条目合并为一次PutEntries调用；调用失败的节点按退避时间重试
 class CacheWriter {
  public:
   static CacheWriter* Instance();
@@ -21,8 +27,47 @@ class CacheWriter {
   std::optional<std::future<bool>> AsyncWrite(const std::string& key, CacheEntry&& cache_entry);
 
  private:
-  std::unique_ptr<cache::CacheService::Stub> stub_;
-  Poco::TaskManager task_manager_;
+  static constexpr std::size_t kMaxCoalescedEntrySize = 256 << 10; // 不超过该大小的条目合并写入
+  static constexpr std::size_t kMaxBatchSize = 4 << 20;            // 一次取出的条目总大小
+  static constexpr std::size_t kMaxAttempts = 3;
+  static constexpr std::chrono::milliseconds kRetryBackoff{200};   // 第n次重试等待kRetryBackoff * 2^(n-1)
+
+  /// @brief 等待写入的条目
+  struct Item {
+    std::string key;
+    std::string data;
+    std::uint32_t compile_cost_ms;
+    std::vector<std::size_t> nodes;   // 尚未写入的节点
+    std::size_t attempts = 0;
+    bool admitted = false;            // 已有节点接受
+    std::chrono::steady_clock::time_point not_before; // 重试时间
+    std::promise<bool> promise;
+  };
+
+  /// @brief 写入线程
+  void WorkerProc();
+
+  /// @brief 写入一批条目，调用失败的节点留在Item::nodes中
+  void WriteBatch(const std::vector<std::unique_ptr<Item>>& batch);
+
+  /// @brief 向一个节点写入一个条目，返回调用是否成功
+  bool PutEntry(std::size_t node, Item* item);
+
+  /// @brief 一次调用向一个节点写入多个条目，返回调用是否成功
+  bool PutEntries(std::size_t node, const std::vector<Item*>& items);
+
+  /// @brief 加入队列，超出容量时丢弃最旧的条目，需持有mutex_
+  void UnsafePush(std::unique_ptr<Item> item);
+
+ private:
+  std::size_t max_queue_size_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::unique_ptr<Item>> queue_;
+  std::size_t queue_size_ = 0;   // 队列中条目的总大小
+  bool stopping_ = false;
+  std::thread worker_;
 };
 
-} // namespace distribuild::daemon::cloud
\ No newline at end of file
+} // namespace distribuild::daemon::cloud
@@ -10,6 +10,7 @@
 #include "daemon/cloud/compile_task/cxx_task.h"
 #include "daemon/cloud/compilers.h"
 #include "daemon/cloud/cache_writer.h"
+#include "daemon/dictionary_keeper.h"
 #include "../build/distribuild/proto/file_desc.grpc.pb.h"
 #include "../build/distribuild/proto/file_desc.pb.h"
 #include "cxx_task.h"
@@ -35,6 +36,7 @@ class PrepareCachePocoTask : public Poco::Task {
      for (auto&& macro : kRejectMacros) {
        if (std::search(source_.begin(), source_.end(), macro.begin(), macro.end()) != source_.end()) {
          promise_.set_value(false);
+         return;
        }
      }
      promise_.set_value(true);
@@ -85,7 +87,13 @@ CxxCompileTask::CxxCompileTask()
   LOG_DEBUG("工作目录：{}", work_dir_.GetPath());
 }
 
+std::string CxxCompileTask::GetSource() {
+  start_tp_ = std::chrono::steady_clock::now();
+  return std::move(source_);
+}
+
 void CxxCompileTask::OnCompleted(int exit_code, std::string&& std_out, std::string&& std_err) {
+  auto compile_cost = std::chrono::steady_clock::now() - start_tp_;
   exit_code_ = exit_code;
   stdout_ = std::move(std_out);
   stderr_ = std::move(std_err);
@@ -101,11 +109,11 @@ void CxxCompileTask::OnCompleted(int exit_code, std::string&& std_out, std::stri
   // 保存额外信息
   extra_info_ = std::move(output->extra_info);
 
-  // 压缩文件并打包
+  // 压缩文件并打包，小文件使用缓存服务器训练的字典
   auto files = output->files;
   for (auto&& [filename, content] : files) {
 	LOG_DEBUG("filename = {}, content size = {}", filename, content.size());
-	auto compressed_content = ZSTDCompress(content);
+	auto compressed_content = DictionaryKeeper::Instance()->Compress(content);
 	DISTBU_CHECK(compressed_content);
 	content = std::move(*compressed_content);
   }
@@ -114,21 +122,37 @@ void CxxCompileTask::OnCompleted(int exit_code, std::string&& std_out, std::stri
 
   if (auto key = GetCacheKey(); key && exit_code == 0) {
 	LOG_DEBUG("写入缓存");
+	cacheable_ = true;
 	// 复制，不用担心写入析构，不需要string_view
 	// ! 复制太多
 	CacheEntry entry = {.exit_code  = exit_code_,
 	                    .std_out    = stdout_,
 						.std_err    = stderr_,
 						.extra_info = extra_info_,
-						.packed     = file_pack_ };
+						.files      = std::move(files),
+						.compile_cost_ms = static_cast<std::uint32_t>(compile_cost / 1ms) };
 	CacheWriter::Instance()->AsyncWrite(*key, std::move(entry));
   }
 }
 
+void CxxCompileTask::OnCacheHit(CacheEntry&& entry) {
+  exit_code_ = entry.exit_code;
+  stdout_ = std::move(entry.std_out);
+  stderr_ = std::move(entry.std_err);
+  extra_info_ = std::move(entry.extra_info);
+  // 缓存中的文件已经压缩过，直接打包
+  file_pack_ = PackFiles(entry.files);
+  cacheable_ = true;
+}
+
 std::optional<std::string> CxxCompileTask::GetCacheKey() const {
-  if (!write_cache_future_ || write_cache_future_->get()) {
+  if (!write_cache_future_ || !write_cache_future_->get()) {
     return std::nullopt;
   }
+  return MakeCacheKey();
+}
+
+std::string CxxCompileTask::MakeCacheKey() const {
   return fmt::format("distribuild-cxx-cache-{}",
     EncodeHex(Blake3({env_desc_.compiler_digest(), args_, source_digest_})));
 }
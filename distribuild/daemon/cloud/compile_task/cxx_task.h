@@ -1,8 +1,10 @@
 #pragma once
+#include <chrono>
 #include <future>
 #include <Poco/TaskManager.h>
 #include "daemon/cloud/task.h"
 #include "daemon/cloud/temp_dir.h"
+#include "daemon/cache.h"
 #include "../build/distribuild/proto/daemon.grpc.pb.h"
 #include "../build/distribuild/proto/daemon.pb.h"
 #include "../build/distribuild/proto/env_desc.grpc.pb.h"
@@ -18,17 +20,23 @@ class CxxCompileTask : public CompileTask {
   /// @brief 编译完成，需要移动语义
   void OnCompleted(int exit_code, std::string&& std_out, std::string&& std_err) override;
 
+  /// @brief 编译前在缓存中找到了结果，不再编译，直接作为任务结果
+  void OnCacheHit(CacheEntry&& entry);
+
   /// @brief 如果允许写入缓存则生成摘要作为key值
   std::optional<std::string> GetCacheKey() const override;
 
+  /// @brief 缓存key，与local查找缓存时使用的key相同
+  std::string MakeCacheKey() const;
+
   /// @brief 由编译器摘要、编译参数、源码摘要生成新摘要
   std::string GetDigest() const override;
 
   /// @brief 获取编译结果文件
   std::optional<Output> GetOutput(int exit_code, std::string& std_out, std::string& std_err) override;
 
-  /// @brief 获取源码，编译写入一次所以移动所有权
-  std::string GetSource() override              { return std::move(source_); }
+  /// @brief 获取源码，编译写入一次所以移动所有权；随后开始编译，记录开始时间
+  std::string GetSource() override;
 
   std::string GetCmdLine() const override       { return cmdline_; }
   int GetExitCode() const override              { return exit_code_; }
@@ -47,6 +55,7 @@ class CxxCompileTask : public CompileTask {
  private:
   // 结果
   int exit_code_;
+  std::chrono::steady_clock::time_point start_tp_; // 开始编译的时间，用于计算编译耗时
   std::string stdout_;
   std::string stderr_;
 
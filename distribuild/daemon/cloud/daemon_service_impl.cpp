@@ -12,6 +12,9 @@
 #include "daemon/cloud/compilers.h"
 #include "daemon/cloud/compile_task/cxx_task.h"
 #include "daemon/sysinfo.h"
+#include "daemon/dictionary_keeper.h"
+#include "daemon/local/cache_reader.h"
+#include "daemon/local/local_cache.h"
 
 using namespace std::literals;
 
@@ -135,6 +138,23 @@ grpc::Status DaemonServiceImpl::QueueCxxTask(grpc::ServerContext *context, grpc:
     return status;
   }
 
+  // 先查缓存，发起请求的daemon的布隆过滤器可能还没有这个结果，命中则不再编译
+  // 同样先查本机的布隆过滤器，最多等待`--cache_read_fallback_ms`，不拖慢未命中的编译
+  if (request->fill_cache() && FLAGS_servant_cache_lookup) {
+	auto key = task->MakeCacheKey();
+	auto entry = local::LocalCache::Instance()->TryGet(key);
+	if (!entry) {
+	  entry = local::CacheReader::Instance()->TryRead(
+		key, false, std::chrono::milliseconds(FLAGS_cache_read_fallback_ms));
+	}
+	if (entry && entry->exit_code == 0) {
+	  LOG_INFO("编译前命中缓存`{}`", key);
+	  task->OnCacheHit(std::move(*entry));
+	  response->set_task_id(Executor::Instance()->AddCompletedTask(request->task_grant_id(), task));
+	  return grpc::Status::OK;
+	}
+  }
+
   // 提交编译得到本机task_id
   auto task_id = Executor::Instance()->TryQueueTask(request->task_grant_id(), task);
   if (!task_id) {
@@ -185,9 +205,14 @@ grpc::Status DaemonServiceImpl::WaitForTask(grpc::ServerContext *context, const
   }
 
   // 验证压缩类型
-  if (request->acceptable_compress_types().at(0) != CompressType::COMPRESS_TYPE_ZSTD) {
+  auto&& compress_types = request->acceptable_compress_types();
+  auto accepts = [&](CompressType type) {
+	return std::find(compress_types.begin(), compress_types.end(), type) != compress_types.end();
+  };
+  if (!accepts(CompressType::COMPRESS_TYPE_ZSTD)) {
   	return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "非法压缩类型");
   }
+  bool accepts_dict = accepts(CompressType::COMPRESS_TYPE_ZSTD_DICT);
 
   // 等待任务
   WaitForTaskResponse* response = new WaitForTaskResponse();
@@ -211,8 +236,28 @@ grpc::Status DaemonServiceImpl::WaitForTask(grpc::ServerContext *context, const
   response->set_exit_code(task->GetExitCode());
   response->set_output(task->GetStdout());
   response->set_err(task->GetStderr());
-  response->set_compress_type(CompressType::COMPRESS_TYPE_ZSTD);
+  response->set_compress_type(accepts_dict ? CompressType::COMPRESS_TYPE_ZSTD_DICT : CompressType::COMPRESS_TYPE_ZSTD);
   *response->mutable_extra_info() = task->GetExtraInfo();
+  response->set_cacheable(task->IsCacheable());
+
+  // 请求者不支持字典时转为普通zstd
+  std::string transcoded;
+  auto* file_pack = &task->GetFilePack();
+  if (!accepts_dict && !file_pack->empty()) {
+	auto files = TryUnpackFiles(*file_pack);
+	if (!files) {
+	  return grpc::Status(grpc::StatusCode::INTERNAL, "解析编译结果失败");
+	}
+	for (auto&& [_, content] : *files) {
+	  auto plain = DictionaryKeeper::Instance()->TryRemoveDictionary(std::move(content));
+	  if (!plain) {
+		return grpc::Status(grpc::StatusCode::INTERNAL, "转换压缩类型失败");
+	  }
+	  content = std::move(*plain);
+	}
+	transcoded = PackFiles(std::move(*files));
+	file_pack = &transcoded;
+  }
 
   // 第一个报文
   WaitForTaskResponseChunk first_chunk;
@@ -220,7 +265,7 @@ grpc::Status DaemonServiceImpl::WaitForTask(grpc::ServerContext *context, const
   writer->Write(first_chunk);
 
   // 发送文件
-  auto&& file = task->GetFilePack();
+  auto&& file = *file_pack;
   LOG_DEBUG("file size = {}", file.size());
   for (std::size_t i = 0; i < file.size(); i += FLAGS_chunk_size) {
 	WaitForTaskResponseChunk chunk;
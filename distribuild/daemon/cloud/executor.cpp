@@ -6,6 +6,7 @@
 #include <Poco/TaskManager.h>
 #include "daemon/cloud/executor.h"
 #include "common/spdlogging.h"
+#include "common/tools.h"
 #include "daemon/sysinfo.h"
 #include "daemon/cloud/excute.h"
 #include "daemon/config.h"
@@ -113,6 +114,24 @@ std::optional<std::uint64_t> Executor::TryQueueTask(std::uint64_t grant_id, std:
   return task_id;
 }
 
+std::uint64_t Executor::AddCompletedTask(std::uint64_t grant_id, std::shared_ptr<Task> user_task) {
+  auto task_desc = std::make_shared<TaskDesc>();
+  task_desc->pid = 0; // 不会与waitpid得到的子进程匹配
+  task_desc->is_running.store(false, std::memory_order_relaxed);
+  task_desc->grant_id = grant_id;
+  task_desc->ref_count = 1;
+  task_desc->start_tp = std::chrono::steady_clock::now();
+  task_desc->completed_tp = task_desc->start_tp;
+  task_desc->cmd = user_task->GetCmdLine();
+  task_desc->task = std::move(user_task);
+  task_desc->completion_event.set();
+
+  std::uint64_t task_id = next_task_id_++;
+  std::scoped_lock lock(task_mutex_);
+  tasks_[task_id] = std::move(task_desc);
+  return task_id;
+}
+
 bool Executor::TryAddTaskRef(std::uint64_t task_id) {
   std::scoped_lock lock(task_mutex_);
   if (auto task = tasks_.find(task_id); task != tasks_.end()) {
@@ -92,6 +92,10 @@ class Executor {
   /// @return 进程pid
   std::optional<std::uint64_t> TryQueueTask(std::uint64_t grant_id, std::shared_ptr<Task> task);
 
+  /// @brief 加入已经完成的任务（如命中缓存），不启动进程，不占用并发数
+  /// @return 任务id
+  std::uint64_t AddCompletedTask(std::uint64_t grant_id, std::shared_ptr<Task> task);
+
   /// @brief 添加任务引用计数
   bool TryAddTaskRef(std::uint64_t task_id);
 
@@ -38,9 +38,11 @@ class CompileTask : public Task {
   virtual std::optional<Output> GetOutput(int exit_code, std::string& std_out, std::string& std_err) = 0;
   const std::string& GetFilePack() const { return file_pack_; }
   const google::protobuf::Any& GetExtraInfo() const { return extra_info_; }
+  bool IsCacheable() const { return cacheable_; }
  protected:
   std::string file_pack_;
   google::protobuf::Any extra_info_;
+  bool cacheable_ = false; // 结果已写入缓存，local可以放入本地缓存
 };
 
 }
\ No newline at end of file
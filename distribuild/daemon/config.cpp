@@ -10,7 +10,7 @@ DEFINE_string(cache_server_token, "nieyang", "缓存节点token");
 
 DEFINE_string(scheduler_location, "127.0.0.1:10005", "调度器地址");
 
-DEFINE_string(cache_server_location, "127.0.0.1:10015", "缓存节点位置");
+DEFINE_string(cache_server_location, "127.0.0.1:10015", "缓存节点位置，多个节点用逗号分隔，按一致性哈希分片");
 
 DEFINE_string(compiler_dir_path, "", "用户自定义编译器位置");
 
@@ -32,4 +32,26 @@ DEFINE_int64(heart_beat_timer_intervals, 1'000, "心跳定时器时间间隔，
 
 DEFINE_uint64(chunk_size, 64 * 1024, "发送文件的分块大小");
 
+DEFINE_int64(cache_batch_window_ms, 2, "读取缓存时等待合并其他读取的时间，默认2ms");
+
+DEFINE_uint32(cache_max_batch_keys, 64, "一次批量读取缓存的最大键数，不能超过缓存服务器的max_batch_keys");
+
+DEFINE_uint32(cache_replicas, 1, "每个缓存条目写入的节点数（含主节点）");
+
+DEFINE_uint32(cache_virtual_nodes, 160, "每个缓存节点在一致性哈希环上的虚拟节点数");
+
+DEFINE_int64(cache_negative_ttl_ms, 10'000, "缓存服务器返回未命中的key在该时间内不再请求，0表示不记录，默认10s");
+
+DEFINE_string(cache_writer_max_queue_size, "128M", "等待写入缓存的条目的最大总大小，超出时丢弃最旧的条目");
+
+DEFINE_bool(servant_cache_lookup, true, "servant编译前查询缓存，命中则不再编译");
+
+DEFINE_string(local_cache_dir, "./distribuild_local_cache", "本地磁盘缓存目录，为空则不启用");
+
+DEFINE_string(local_cache_size, "1G", "本地磁盘缓存的最大大小");
+
+DEFINE_uint32(local_cache_prefetch_keys, 1000, "空闲时从缓存服务器预取到本地缓存的热点条目数，0表示不预取");
+
+DEFINE_int64(cache_read_fallback_ms, 50, "主节点读取超过该时间仍未返回时向副本读取，默认50ms");
+
 }
\ No newline at end of file
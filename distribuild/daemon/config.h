@@ -36,4 +36,26 @@ DECLARE_int64(heart_beat_timer_intervals);
 
 DECLARE_uint64(chunk_size);
 
+DECLARE_int64(cache_batch_window_ms);
+
+DECLARE_uint32(cache_max_batch_keys);
+
+DECLARE_uint32(cache_replicas);
+
+DECLARE_uint32(cache_virtual_nodes);
+
+DECLARE_int64(cache_read_fallback_ms);
+
+DECLARE_int64(cache_negative_ttl_ms);
+
+DECLARE_string(cache_writer_max_queue_size);
+
+DECLARE_bool(servant_cache_lookup);
+
+DECLARE_string(local_cache_dir);
+
+DECLARE_string(local_cache_size);
+
+DECLARE_uint32(local_cache_prefetch_keys);
+
 }
\ No newline at end of file
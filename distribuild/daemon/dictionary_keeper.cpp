@@ -0,0 +1,130 @@
+#include "daemon/dictionary_keeper.h"
+#include "daemon/cache_cluster.h"
+#include "daemon/config.h"
+#include "common/spdlogging.h"
+#include "common/tools.h"
+
+using namespace std::literals;
+
+namespace distribuild::daemon {
+
+DictionaryKeeper* DictionaryKeeper::Instance() {
+  static DictionaryKeeper instance;
+  return &instance;
+}
+
+DictionaryKeeper::DictionaryKeeper()
+  : timer_(0, 600'000) /* 10min */ {
+  if (!IsEnabled()) {
+	return;
+  }
+
+  timer_.start(Poco::TimerCallback<DictionaryKeeper>(*this, &DictionaryKeeper::OnTimerFetchLatest));
+}
+
+DictionaryKeeper::~DictionaryKeeper() {
+  timer_.stop();
+}
+
+bool DictionaryKeeper::IsEnabled() const noexcept {
+  return CacheCluster::Instance()->IsEnabled();
+}
+
+std::optional<std::string> DictionaryKeeper::Compress(std::string_view content) {
+  std::shared_ptr<const ZSTDDictionary> dict;
+  if (content.size() <= kMaxDictionaryFileSize) {
+	std::scoped_lock lock(mutex_);
+	dict = latest_;
+  }
+  return dict ? ZSTDCompress(content, *dict) : ZSTDCompress(content);
+}
+
+std::optional<std::string> DictionaryKeeper::TryRemoveDictionary(std::string&& file) {
+  auto id = ZSTDGetDictId(file);
+  if (id == 0) {
+	return std::move(file);
+  }
+  auto dict = TryGet(id);
+  if (!dict) {
+	LOG_WARN("找不到字典{}", id);
+	return std::nullopt;
+  }
+  auto decompressed = ZSTDDecompress(file, dict.get());
+  if (!decompressed) {
+	return std::nullopt;
+  }
+  return ZSTDCompress(*decompressed);
+}
+
+bool DictionaryKeeper::HasDictionaries(const std::vector<std::pair<std::string, std::string>>& files) {
+  for (auto&& [suffix, content] : files) {
+	if (auto id = ZSTDGetDictId(content); id && !TryGet(id)) {
+	  LOG_WARN("找不到`{}`文件使用的字典{}", suffix, id);
+	  return false;
+	}
+  }
+  return true;
+}
+
+std::shared_ptr<const ZSTDDictionary> DictionaryKeeper::TryGet(std::uint32_t id) {
+  {
+	std::scoped_lock lock(mutex_);
+	if (auto iter = dictionaries_.find(id); iter != dictionaries_.end()) {
+	  return iter->second;
+	}
+  }
+  return TryFetch(id);
+}
+
+std::shared_ptr<const ZSTDDictionary> DictionaryKeeper::TryFetch(std::uint32_t id) {
+  auto cluster = CacheCluster::Instance();
+  if (!cluster->IsEnabled()) {
+	return nullptr;
+  }
+
+  // 字典由一个节点训练，其余节点从它同步，最新的字典向第一个节点获取；
+  // 按ID获取时依次询问各节点，条目所在的节点保留着它引用的字典
+  cache::FetchDictionaryResponse resp;
+  bool found = false;
+  for (std::size_t i = 0; !found && i < (id ? cluster->GetNumNodes() : 1); ++i) {
+	grpc::ClientContext context;
+	cache::FetchDictionaryRequest req;
+	SetTimeout(&context, 10s);
+	req.set_token(FLAGS_cache_server_token);
+	req.set_dictionary_id(id);
+
+	auto status = cluster->GetStub(i)->FetchDictionary(&context, req, &resp);
+	if (!status.ok() && status.error_code() != grpc::StatusCode::NOT_FOUND) {
+	  LOG_WARN("向`{}`获取字典失败：{}", cluster->GetLocation(i), status.error_message());
+	}
+	found = status.ok();
+  }
+  if (!found) {
+	return nullptr;
+  }
+  auto dict = ZSTDDictionary::Create(std::move(*resp.mutable_dictionary()));
+  if (!dict || (id && dict->GetId() != id)) {
+	LOG_WARN("无法解析字典{}", resp.dictionary_id());
+	return nullptr;
+  }
+
+  std::scoped_lock lock(mutex_);
+  auto [iter, inserted] = dictionaries_.try_emplace(dict->GetId(), dict);
+  if (id == 0) {
+	latest_ = iter->second;
+  }
+  if (inserted) {
+	LOG_INFO("获取字典{}，大小：{}", dict->GetId(), dict->GetBytes().size());
+	// 旧字典只在读到很久以前的条目时才需要，超出数量时随意移除一个
+	for (auto e = dictionaries_.begin(); dictionaries_.size() > kMaxDictionaries && e != dictionaries_.end();) {
+	  e = e->second == latest_ || e->second == dict ? std::next(e) : dictionaries_.erase(e);
+	}
+  }
+  return dict;
+}
+
+void DictionaryKeeper::OnTimerFetchLatest(Poco::Timer& timer) {
+  TryFetch(0);
+}
+
+} // namespace distribuild::daemon
@@ -0,0 +1,57 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <Poco/Timer.h>
+#include "common/crypto/zstd.h"
+
+namespace distribuild::daemon {
+
+/// @brief 缓存服务器训练的zstd字典
+/// servant用最新的字典压缩小的编译产物；local读到使用字典压缩的文件时按帧头中的ID获取字典，
+/// 转为普通zstd再交给客户端，客户端不需要字典
+class DictionaryKeeper {
+ public:
+  static DictionaryKeeper* Instance();
+
+  DictionaryKeeper();
+  ~DictionaryKeeper();
+
+  /// @brief 是否可以获取字典（配置了缓存服务器）
+  bool IsEnabled() const noexcept;
+
+  /// @brief 压缩编译产物，已有字典且文件较小时使用字典
+  std::optional<std::string> Compress(std::string_view content);
+
+  /// @brief 把使用字典压缩的文件转为普通zstd压缩，未使用字典的原样返回；找不到字典时返回空
+  std::optional<std::string> TryRemoveDictionary(std::string&& file);
+
+  /// @brief 读到缓存条目时调用，获取文件使用的字典，有字典获取不到时条目无法使用，应按未命中处理
+  bool HasDictionaries(const std::vector<std::pair<std::string, std::string>>& files);
+
+ private:
+  static constexpr std::size_t kMaxDictionaryFileSize = 1 << 20; // 大文件用字典收益很小
+  static constexpr std::size_t kMaxDictionaries = 16;             // 本地最多保留的字典数，更旧的需要时再获取
+
+  /// @brief 按ID查找字典，本地没有时向缓存服务器获取
+  std::shared_ptr<const ZSTDDictionary> TryGet(std::uint32_t id);
+
+  /// @brief 向缓存服务器获取字典，id为0时获取最新的字典
+  std::shared_ptr<const ZSTDDictionary> TryFetch(std::uint32_t id);
+
+  /// @brief 定时器函数，获取最新的字典
+  void OnTimerFetchLatest(Poco::Timer& timer);
+
+ private:
+  Poco::Timer timer_;
+
+  std::mutex mutex_;
+  std::shared_ptr<const ZSTDDictionary> latest_;
+  std::unordered_map<std::uint32_t, std::shared_ptr<const ZSTDDictionary>> dictionaries_;
+};
+
+} // namespace distribuild::daemon
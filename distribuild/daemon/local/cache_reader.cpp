@@ -2,33 +2,59 @@
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/impl/codegen/time.h>
+#include <functional>
+#include <unordered_map>
+#include <Poco/Exception.h>
+#include <Poco/Task.h>
 #include "common/spdlogging.h"
 #include "common/tools.h"
 #include "daemon/local/cache_reader.h"
+#include "daemon/cache_cluster.h"
+#include "daemon/dictionary_keeper.h"
 #include "daemon/config.h"
 
 using namespace std::literals;
 
 namespace distribuild::daemon::local {
 
+namespace {
+
+class ReadBatchPocoTask : public Poco::Task {
+  std::function<void()> read_batch_;
+ public:
+  explicit ReadBatchPocoTask(std::function<void()> read_batch)
+    : Poco::Task("ReadBatchPocoTask")
+    , read_batch_(std::move(read_batch)) {}
+
+  virtual void runTask() override {
+    read_batch_();
+  }
+};
+
+} // namespace
+
 CacheReader* CacheReader::Instance() {
   static CacheReader instance;
   return &instance;
 }
 
 CacheReader::CacheReader()
-  : timer_(0, 3'000) /* 3s */ {
-  if (FLAGS_cache_server_location.empty()) {
+  : timer_(0, 3'000) /* 3s */
+  , thread_pool_(2, kMaxConcurrentBatches)
+  , task_manager_(thread_pool_) {
+  auto cluster = CacheCluster::Instance();
+  if (!cluster->IsEnabled()) {
 	return;
   }
 
-  auto channel = grpc::CreateChannel(FLAGS_cache_server_location, grpc::InsecureChannelCredentials());
-  stub_ = cache::CacheService::NewStub(channel);
-  DISTBU_CHECK(stub_);
+  for (std::size_t i = 0; i < cluster->GetNumNodes(); ++i) {
+	shards_.push_back(std::make_unique<Shard>());
+	shards_.back()->location = cluster->GetLocation(i);
+	shards_.back()->stub = cluster->GetStub(i);
+  }
 
   // 创建成功后立即填充布隆过滤器
   OnTimerLoadBloomFilter(timer_);
-  last_bf_full_update_ = last_bf_update_ = std::chrono::steady_clock::now();
 
   LOG_INFO("启动定时器 OnTimerLoadBloomFilter");
   timer_.start(Poco::TimerCallback<CacheReader>(*this, &CacheReader::OnTimerLoadBloomFilter));
@@ -36,54 +62,303 @@ CacheReader::CacheReader()
 
 CacheReader::~CacheReader() {
   timer_.stop();
+  task_manager_.joinAll();
 }
 
-std::optional<CacheEntry> CacheReader::TryRead(const std::string& key) {
-  return std::nullopt;
-  if (!stub_) {
+std::optional<CacheEntry> CacheReader::TryRead(const std::string& key, bool record_miss,
+  std::optional<std::chrono::milliseconds> timeout) {
+  if (shards_.empty()) {
 	return std::nullopt; // 未启用缓存
   }
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+  if (timeout) {
+	deadline = std::chrono::steady_clock::now() + *timeout;
+  }
 
+  // 刚确认未命中的key直接返回；相同key的并发读取只有第一个发起请求，其他等待它的结果
+  std::shared_ptr<Flight> flight;
+  bool is_owner = false;
   {
-	std::scoped_lock lock(bf_mutex_);
-	if (last_bf_update_ > std::chrono::steady_clock::now() + 10min ||
-	    !bloom_filter_.PossiblyContains(key)) { // 超时或不存在
-	  return std::nullopt;
+	std::scoped_lock lock(flight_mutex_);
+	if (auto iter = misses_.find(key); iter != misses_.end()) {
+	  if (std::chrono::steady_clock::now() < iter->second) {
+		return std::nullopt;
+	  }
+	  misses_.erase(iter);
+	}
+	auto&& e = inflight_[key];
+	if (e) {
+	  ++e->waiters;
+	} else {
+	  e = std::make_shared<Flight>();
+	  e->future = e->promise.get_future().share();
+	  is_owner = true;
 	}
+	flight = e;
   }
 
-  // 可能存在，准备获取
-  grpc::ClientContext context;
-  cache::TryGetEntryRequest  req;
-  grpc::CompletionQueue cq;
+  std::optional<std::string> data;
+  if (is_owner) {
+	bool missed = false;
+	data = ReadFromCluster(key, deadline, &missed);
+	std::size_t waiters;
+	{
+	  std::scoped_lock lock(flight_mutex_);
+	  inflight_.erase(key);
+	  waiters = flight->waiters;
+	  if (missed && record_miss && FLAGS_cache_negative_ttl_ms > 0) {
+		UnsafeAddMiss(key);
+	  }
+	}
+	// 不再有新的等待者，没有等待者时不需要复制
+	flight->promise.set_value(waiters ? data : std::nullopt);
+  } else if (!deadline || flight->future.wait_until(*deadline) == std::future_status::ready) {
+	data = flight->future.get();
+  }
+  if (!data) {
+	return std::nullopt;
+  }
+
+  auto entry = TryParseCacheEntry(std::move(*data));
+  if (!entry) {
+	LOG_ERROR("解析缓存数据失败");
+    return std::nullopt;
+  }
+  if (!DictionaryKeeper::Instance()->HasDictionaries(entry->files)) {
+	return std::nullopt; // 无法解压，重新编译
+  }
+  LOG_INFO("读取缓存成功");
+  
+  return entry;
+}
+
+std::vector<std::pair<std::string, CacheEntry>> CacheReader::Prefetch(std::size_t node,
+  const std::vector<std::string>& keys) {
+  std::vector<std::pair<std::string, CacheEntry>> result;
+  if (node >= shards_.size()) {
+	return result;
+  }
+
+  for (std::size_t i = 0; i < keys.size(); i += FLAGS_cache_max_batch_keys) {
+	std::vector<std::shared_ptr<PendingRead>> batch;
+	for (std::size_t j = i; j < std::min<std::size_t>(keys.size(), i + FLAGS_cache_max_batch_keys); ++j) {
+	  auto read = std::make_shared<PendingRead>();
+	  read->key = keys[j];
+	  read->result = std::make_shared<ReadResult>();
+	  read->result->outstanding = 1;
+	  batch.push_back(std::move(read));
+	}
+	// 在当前线程发送，返回时所有读取都已完成
+	ReadBatch(*shards_[node], batch, true);
+	for (auto&& read : batch) {
+	  if (!read->result->data) {
+		continue;
+	  }
+	  auto entry = TryParseCacheEntry(std::move(*read->result->data));
+	  if (!entry) {
+		LOG_WARN("解析预取的缓存`{}`失败", read->key);
+		continue;
+	  }
+	  if (!DictionaryKeeper::Instance()->HasDictionaries(entry->files)) {
+		continue;
+	  }
+	  result.emplace_back(read->key, std::move(*entry));
+	}
+  }
+  return result;
+}
+
+std::optional<std::string> CacheReader::ReadFromCluster(const std::string& key,
+  std::optional<std::chrono::steady_clock::time_point> deadline, bool* missed) {
+  // 只向布隆过滤器中可能有该key的节点读取，主节点在前
+  std::vector<Shard*> candidates;
+  for (auto&& e : CacheCluster::Instance()->GetNodes(key)) {
+	if (PossiblyContains(*shards_[e], key)) {
+	  candidates.push_back(shards_[e].get());
+	}
+  }
+  if (candidates.empty()) { // 超时或不存在
+	return std::nullopt;
+  }
+
+  // 先读第一个节点；超过`--cache_read_fallback_ms`未返回或未命中时再读下一个节点，先命中的结果生效
+  auto result = std::make_shared<ReadResult>();
+  std::size_t next = 0;
+  while (true) {
+	if (next < candidates.size()) {
+	  {
+		std::scoped_lock lock(result->mutex);
+		++result->outstanding;
+	  }
+	  Read(*candidates[next++], key, result);
+	}
+	std::unique_lock lock(result->mutex);
+	auto done = [&] { return result->data || result->outstanding == 0; };
+	if (next < candidates.size()) {
+	  auto fallback = std::chrono::steady_clock::now() + std::chrono::milliseconds(FLAGS_cache_read_fallback_ms);
+	  result->cv.wait_until(lock, deadline ? std::min(fallback, *deadline) : fallback, done);
+	} else if (deadline) {
+	  result->cv.wait_until(lock, *deadline, done);
+	} else {
+	  result->cv.wait(lock, done);
+	}
+	if (result->data || (result->outstanding == 0 && next == candidates.size())) {
+	  break;
+	}
+	if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+	  *missed = false; // 超时不算未命中
+	  return std::move(result->data);
+	}
+  }
+
+  // 所有读取的节点都明确返回未命中时才记为未命中，出错或超时的不记
+  std::scoped_lock lock(result->mutex);
+  *missed = !result->data && result->missed == next;
+  return std::move(result->data);
+}
+
+void CacheReader::UnsafeAddMiss(const std::string& key) {
+  auto now = std::chrono::steady_clock::now();
+  if (misses_.size() >= kMaxMisses) {
+	for (auto iter = misses_.begin(); iter != misses_.end();) {
+	  iter = iter->second <= now ? misses_.erase(iter) : std::next(iter);
+	}
+	if (misses_.size() >= kMaxMisses) {
+	  misses_.clear();
+	}
+  }
+  misses_[key] = now + std::chrono::milliseconds(FLAGS_cache_negative_ttl_ms);
+}
+
+bool CacheReader::PossiblyContains(Shard& shard, const std::string& key) {
+  std::scoped_lock lock(shard.bf_mutex);
+  return std::chrono::steady_clock::now() - shard.last_bf_update <= 10min &&
+         shard.bloom_filter.PossiblyContains(key);
+}
+
+void CacheReader::Read(Shard& shard, const std::string& key, std::shared_ptr<ReadResult> result) {
+  // 加入批次，短时间内并发的读取合并为一次RPC
+  auto read = std::make_shared<PendingRead>();
+  read->key = key;
+  read->result = std::move(result);
+
+  bool is_leader;
+  {
+	std::scoped_lock lock(shard.batch_mutex);
+	is_leader = shard.batch.empty();
+	shard.batch.push_back(read);
+	if (shard.batch.size() >= FLAGS_cache_max_batch_keys) {
+	  shard.batch_full_cv.notify_one();
+	}
+  }
+  if (!is_leader) {
+	return;
+  }
+
+  // 每次最多取出`--cache_max_batch_keys`个，超出服务器的限制时整批都会失败；
+  // 等待期间加入的读取可能超出，剩余的由当前线程继续发送，新的读取看到批次非空不会成为发送者
+  auto max_keys = std::max<std::size_t>(FLAGS_cache_max_batch_keys, 1);
+  bool has_more = true;
+  while (has_more) {
+	auto batch = std::make_shared<std::vector<std::shared_ptr<PendingRead>>>();
+	{
+	  std::unique_lock lock(shard.batch_mutex);
+	  shard.batch_full_cv.wait_for(lock, std::chrono::milliseconds(FLAGS_cache_batch_window_ms), [&] {
+		return shard.batch.size() >= max_keys;
+	  });
+	  auto end = shard.batch.begin() + std::min(shard.batch.size(), max_keys);
+	  batch->assign(std::make_move_iterator(shard.batch.begin()), std::make_move_iterator(end));
+	  shard.batch.erase(shard.batch.begin(), end);
+	  has_more = !shard.batch.empty();
+	}
+	// 在线程池中发送，发起读取的线程可以等待超时后转向副本
+	try {
+	  task_manager_.start(new ReadBatchPocoTask([this, &shard, batch] { ReadBatch(shard, std::move(*batch)); }));
+	} catch (const Poco::Exception& e) {
+	  LOG_WARN("线程池已满，直接读取缓存：{}", e.displayText());
+	  ReadBatch(shard, std::move(*batch));
+	}
+  }
+}
+
+void CacheReader::Complete(PendingRead* read, std::optional<std::string> data, bool missed) {
+  auto&& result = *read->result;
+  std::scoped_lock lock(result.mutex);
+  if (data && !result.data) {
+	result.data = std::move(data);
+  }
+  result.missed += missed;
+  --result.outstanding;
+  result.cv.notify_all();
+}
+
+void CacheReader::ReadBatch(Shard& shard, std::vector<std::shared_ptr<PendingRead>> batch, bool prefetch) {
+  // 相同的键只请求一次
+  cache::TryGetEntriesRequest req;
+  std::vector<std::vector<PendingRead*>> waiters;
+  std::unordered_map<std::string_view, std::size_t> indices;
+  for (auto&& read : batch) {
+	auto [iter, inserted] = indices.try_emplace(read->key, waiters.size());
+	if (inserted) {
+	  req.add_keys(read->key);
+	  waiters.emplace_back();
+	}
+	waiters[iter->second].push_back(read.get());
+  }
 
+  std::vector<std::string> data(waiters.size());
+  std::vector<bool> done(waiters.size());
+  auto complete = [&](std::size_t index, std::optional<std::string> result, bool missed = false) {
+	if (index >= waiters.size() || done[index]) {
+	  return;
+	}
+	done[index] = true;
+	for (std::size_t i = 1; i < waiters[index].size(); ++i) {
+	  Complete(waiters[index][i], result, missed);
+	}
+	Complete(waiters[index].front(), std::move(result), missed);
+  };
+
+  grpc::ClientContext context;
   SetTimeout(&context, 10s);
   req.set_token(FLAGS_cache_server_token);
-  req.set_key(key);
+  req.set_prefetch(prefetch);
 
-  std::string data;
-  cache::TryGetEntryResponseChunk chunk;
-  auto reader = stub_->TryGetEntry(&context, req);
+  // 每个键读完最后一个分块立即完成，不等待其他键
+  cache::TryGetEntriesResponseChunk chunk;
+  auto reader = shard.stub->TryGetEntries(&context, req);
   while (reader->Read(&chunk)) {
-    data.append(chunk.file_chunk().data(), chunk.file_chunk().size());
+	for (auto&& e : chunk.missed_key_indices()) {
+	  complete(e, std::nullopt, true);
+	}
+	auto index = chunk.key_index();
+	if (index >= data.size() || done[index] || (chunk.file_chunk().empty() && !chunk.last_chunk())) {
+	  continue;
+	}
+	data[index].append(chunk.file_chunk());
+	if (chunk.last_chunk()) {
+	  complete(index, std::move(data[index]));
+	}
   }
   grpc::Status status = reader->Finish();
   if (!status.ok()) {
-	LOG_ERROR("读取缓存失败：{}", status.error_message());
-    return std::nullopt;
+	LOG_ERROR("向`{}`批量读取缓存失败：{}", shard.location, status.error_message());
   }
 
-  auto entry = TryParseCacheEntry(std::move(data));
-  if (!entry) {
-	LOG_ERROR("解析缓存数据失败");
-    return std::nullopt;
+  // 出错或服务器未返回的键按未命中处理
+  for (std::size_t i = 0; i < waiters.size(); ++i) {
+	complete(i, std::nullopt);
   }
-  LOG_INFO("读取缓存成功");
-  
-  return entry;
+  LOG_DEBUG("批量读取缓存：{} 个读取，{} 个键", batch.size(), waiters.size());
 }
 
 void CacheReader::OnTimerLoadBloomFilter(Poco::Timer& timer) {
+  for (auto&& e : shards_) {
+	LoadBloomFilter(*e);
+  }
+}
+
+void CacheReader::LoadBloomFilter(Shard& shard) {
   auto now = std::chrono::steady_clock::now();
 
   grpc::ClientContext context;
@@ -93,37 +368,42 @@ void CacheReader::OnTimerLoadBloomFilter(Poco::Timer& timer) {
   SetTimeout(&context, 10s);
   req.set_token(FLAGS_cache_server_token);
   {
-	std::scoped_lock lock(bf_mutex_);
-	if (last_bf_full_update_.time_since_epoch() == 0s) {
-      // 初次强制更新
-	  req.set_secs_last_fetch(0x7fff'ffff);
-	  req.set_secs_last_full_fetch(0x7fff'ffff);
-	} else {
-	  req.set_secs_last_fetch((now - last_bf_update_) / 1s);
-	  req.set_secs_last_full_fetch((now - last_bf_full_update_) / 1s);
-	}
+	std::scoped_lock lock(shard.bf_mutex);
+	req.set_secs_last_full_fetch(shard.bf_generation ? (now - shard.last_bf_full_update) / 1s : 0x7fff'ffff);
+	req.set_generation(shard.bf_generation);
   }
 
-  auto status = stub_->FetchBloomFilter(&context, req, &resp);
+  auto status = shard.stub->FetchBloomFilter(&context, req, &resp);
   if (!status.ok()) {
-	LOG_WARN("获取布隆过滤器失败：{}", status.error_message());
+	LOG_WARN("获取`{}`的布隆过滤器失败：{}", shard.location, status.error_message());
 	return;
   }
-  last_bf_update_ = now;
 
-  if (resp.incremental()) {
-	// 增量更新
-	for (auto&& e : resp.newly_populated_keys()) {
-	  std::scoped_lock lock(bf_mutex_);
-	  bloom_filter_.Add(e);
+  std::optional<CountingBloomFilter> bloom_filter;
+  if (!resp.incremental()) {
+	// 全量更新，在锁外解压解析
+	bloom_filter = CountingBloomFilter::Deserialize(resp.bloom_filter());
+	if (!bloom_filter) {
+	  LOG_WARN("无法解析布隆过滤器，大小：{}", resp.bloom_filter().size());
+	  return;
 	}
-	LOG_INFO("更新了{}个新的键", resp.newly_populated_keys_size());
-  } else {
-    // 全量更新
-	last_bf_full_update_ = now;
-	// TODO: bytes解析
-	// TODO: 流式传输或元数据
+	LOG_DEBUG("全量更新布隆过滤器，大小：{}", resp.bloom_filter().size());
+  }
+
+  std::scoped_lock lock(shard.bf_mutex);
+  if (bloom_filter) {
+	shard.bloom_filter = std::move(*bloom_filter);
+	shard.last_bf_full_update = now;
+  }
+  // 先加入再移除，被移除的key一定已经加入过
+  for (auto&& e : resp.newly_populated_hashes()) {
+	shard.bloom_filter.AddHash(e);
+  }
+  for (auto&& e : resp.removed_hashes()) {
+	shard.bloom_filter.RemoveHash(e);
   }
+  shard.bf_generation = resp.generation();
+  shard.last_bf_update = now;
 }
 
 } // namespace distribuild::daemon::local
\ No newline at end of file
@@ -2,15 +2,24 @@
 #include <optional>
 #include <string>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <Poco/Timer.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/TaskManager.h>
+#include "common/bloom_filter.h"
 #include "daemon/cache.h"
-#include "daemon/bloom_filter.h"
 #include "../build/distribuild/proto/cache.grpc.pb.h"
 #include "../build/distribuild/proto/cache.pb.h"
 
 namespace distribuild::daemon::local {
 
 /// @brief 从编译缓存中读取文件
+/// 每个缓存节点（分片）有各自的布隆过滤器与读取批次，key只向一致性哈希环上保存它的节点读取
 class CacheReader {
  public:
   static CacheReader* Instance();
@@ -18,19 +27,94 @@ class CacheReader {
   CacheReader();
   ~CacheReader();
 
-  std::optional<CacheEntry> TryRead(const std::string& key);
+  /// @param record_miss 是否记录未命中；servant编译前确认时不记录，之后通常紧接着编译并写入缓存
+  /// @param timeout 最长等待时间，超时按未命中处理（不记录）
+  std::optional<CacheEntry> TryRead(const std::string& key, bool record_miss = true,
+                                    std::optional<std::chrono::milliseconds> timeout = std::nullopt);
+
+  /// @brief 直接向一个节点读取一批key（预取），服务器不计入访问频率与热点
+  /// @return 命中的key与条目
+  std::vector<std::pair<std::string, CacheEntry>> Prefetch(std::size_t node, const std::vector<std::string>& keys);
 
  private:
-  /// @brief 定时器函数，刷新布隆过滤器
+  static constexpr int kMaxConcurrentBatches = 64;
+  static constexpr std::size_t kMaxMisses = 65'536;
+
+  /// @brief 一个key在多个节点上的读取结果，任一节点命中即完成
+  struct ReadResult {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::size_t outstanding = 0;      // 尚未返回的读取数
+    std::size_t missed = 0;           // 服务器明确返回未命中的读取数
+    std::optional<std::string> data;
+  };
+
+  /// @brief 等待合并发送的一次读取
+  struct PendingRead {
+    std::string key;
+    std::shared_ptr<ReadResult> result;
+  };
+
+  /// @brief 正在进行的读取，相同key的其他读取等待其结果
+  struct Flight {
+    std::promise<std::optional<std::string>> promise;
+    std::shared_future<std::optional<std::string>> future;
+    std::size_t waiters = 0;
+  };
+
+  /// @brief 一个缓存节点
+  struct Shard {
+    std::string location;
+    cache::CacheService::Stub* stub;
+
+    std::mutex batch_mutex;
+    std::condition_variable batch_full_cv;
+    std::vector<std::shared_ptr<PendingRead>> batch; // 等待合并发送的读取，第一个加入的线程负责发送
+
+    std::mutex bf_mutex;
+    std::chrono::steady_clock::time_point last_bf_update;      // 最近的布隆过滤器增量更新时间
+    std::chrono::steady_clock::time_point last_bf_full_update; // 最近的布隆过滤器全量更新时间
+    std::uint64_t bf_generation = 0;  // 布隆过滤器版本，0表示尚未获取
+    CountingBloomFilter bloom_filter; // 计数器版本，淘汰的key可以被移除
+  };
+
+  /// @brief 向保存key的节点读取，主节点慢或未命中时转向副本
+  /// @param deadline 到期仍未命中则放弃，读取在线程池中继续完成
+  /// @param missed 所有读取的节点都返回未命中时置为true
+  std::optional<std::string> ReadFromCluster(const std::string& key,
+                                             std::optional<std::chrono::steady_clock::time_point> deadline,
+                                             bool* missed);
+
+  /// @brief 记录未命中的key，`--cache_negative_ttl_ms`内不再请求，需持有flight_mutex_
+  void UnsafeAddMiss(const std::string& key);
+
+  /// @brief 布隆过滤器未过期且可能包含key
+  bool PossiblyContains(Shard& shard, const std::string& key);
+
+  /// @brief 向一个节点读取key，加入该节点的批次，完成时更新result
+  void Read(Shard& shard, const std::string& key, std::shared_ptr<ReadResult> result);
+
+  /// @brief 一次RPC读取一批键，完成其中所有读取
+  void ReadBatch(Shard& shard, std::vector<std::shared_ptr<PendingRead>> batch, bool prefetch = false);
+
+  /// @brief 完成一次读取
+  static void Complete(PendingRead* read, std::optional<std::string> data, bool missed = false);
+
+  /// @brief 定时器函数，刷新所有节点的布隆过滤器
   void OnTimerLoadBloomFilter(Poco::Timer& timer);
 
+  /// @brief 刷新一个节点的布隆过滤器
+  void LoadBloomFilter(Shard& shard);
+
  private:
-  std::unique_ptr<cache::CacheService::Stub> stub_;
+  std::vector<std::unique_ptr<Shard>> shards_; // 下标与CacheCluster中的节点编号一致
   Poco::Timer timer_;
-  std::chrono::steady_clock::time_point last_bf_update_;      // 最近的布隆过滤器增量更新时间
-  std::chrono::steady_clock::time_point last_bf_full_update_; // 最近的布隆过滤器全量更新时间
-  std::mutex  bf_mutex_;
-  BloomFilter bloom_filter_;
+  Poco::ThreadPool thread_pool_;  // 发送批次，读取线程可以在主节点慢时转向副本
+  Poco::TaskManager task_manager_;
+
+  std::mutex flight_mutex_;
+  std::unordered_map<std::string, std::shared_ptr<Flight>> inflight_;               // 正在读取的key
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point> misses_;  // 未命中的key -> 过期时间
 };
 
-} // namespace distribuild::daemon::local
\ No newline at end of file
+} // namespace distribuild::daemon::local
@@ -19,6 +19,7 @@ struct DistTask {
 	std::string std_err;
 	google::protobuf::Any extra_info; // ? 是否支持移动语义?
 	std::vector<std::pair<std::string, std::string>> output_files;
+	bool cacheable = false; // servant已将结果写入缓存，可以放入本地缓存
   };
   
   virtual bool CacheControl() = 0;
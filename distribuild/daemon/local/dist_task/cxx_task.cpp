@@ -7,6 +7,7 @@
 #include "../build/distribuild/proto/daemon.grpc.pb.h"
 #include "../build/distribuild/proto/daemon.pb.h"
 #include "daemon/config.h"
+#include "daemon/dictionary_keeper.h"
 
 using namespace std::literals;
 
@@ -107,9 +108,18 @@ std::optional<CxxDistTask::Output> CxxDistTask::RebuildOutput(DistOutput&& outpu
 	return std::make_pair(std::move(res), std::move(buffers));
   }
 
+  // 缓存或servant返回的文件可能使用了字典，客户端只能解压普通zstd
   for (auto&& [suffix, content] : output.output_files) {
+	auto plain = DictionaryKeeper::Instance()->TryRemoveDictionary(std::move(content));
+	if (!plain) {
+	  LOG_ERROR("转换`{}`文件的压缩类型失败", suffix);
+	  res.set_exit_code(-1);
+	  res.clear_file_extensions();
+	  buffers.clear();
+	  break;
+	}
 	res.add_file_extensions(std::move(suffix));
-	buffers.push_back(std::move(content));
+	buffers.push_back(std::move(*plain));
   }
 
   return std::make_pair(std::move(res), std::move(buffers));
@@ -0,0 +1,146 @@
+#include <unordered_set>
+#include <grpcpp/grpcpp.h>
+#include "daemon/local/local_cache.h"
+#include "daemon/local/cache_reader.h"
+#include "daemon/local/task_monitor.h"
+#include "daemon/cloud/executor.h"
+#include "daemon/cache_cluster.h"
+#include "daemon/dictionary_keeper.h"
+#include "daemon/config.h"
+#include "common/spdlogging.h"
+#include "common/tools.h"
+
+using namespace std::literals;
+
+namespace distribuild::daemon::local {
+
+LocalCache* LocalCache::Instance() {
+  static LocalCache instance;
+  return &instance;
+}
+
+LocalCache::LocalCache()
+  : timer_(0, 10'000) /* 10s */
+  , prefetch_timer_(60'000, 60'000) /* 1min */ {
+  if (FLAGS_local_cache_dir.empty()) {
+	return;
+  }
+
+  disk_cache_ = std::make_unique<cache::DiskCache>(FLAGS_local_cache_dir, ParseMemorySize(FLAGS_local_cache_size));
+  disk_cache_->Start();
+  LOG_INFO("本地缓存目录：`{}`，大小：{}", FLAGS_local_cache_dir, FLAGS_local_cache_size);
+
+  timer_.start(Poco::TimerCallback<LocalCache>(*this, &LocalCache::OnTimerPurge));
+  if (FLAGS_local_cache_prefetch_keys > 0 && CacheCluster::Instance()->IsEnabled()) {
+	prefetch_timer_.start(Poco::TimerCallback<LocalCache>(*this, &LocalCache::OnTimerPrefetch));
+  }
+}
+
+LocalCache::~LocalCache() {
+  stopping_ = true;
+  prefetch_timer_.stop();
+  timer_.stop();
+}
+
+std::optional<CacheEntry> LocalCache::TryGet(const std::string& key) {
+  if (!disk_cache_) {
+	return std::nullopt;
+  }
+  last_access_ = std::chrono::steady_clock::now().time_since_epoch().count();
+  auto bytes = disk_cache_->TryGet(key);
+  if (!bytes) {
+	return std::nullopt;
+  }
+  auto entry = TryParseCacheEntry(bytes->ToString());
+  if (!entry) {
+	LOG_WARN("解析本地缓存`{}`失败", key);
+	return std::nullopt;
+  }
+  if (!DictionaryKeeper::Instance()->HasDictionaries(entry->files)) {
+	return std::nullopt; // 无法解压，重新编译后覆盖
+  }
+  return entry;
+}
+
+void LocalCache::Put(const std::string& key, CacheEntry entry) {
+  if (!disk_cache_ || entry.exit_code != 0) {
+	return;
+  }
+  last_access_ = std::chrono::steady_clock::now().time_since_epoch().count();
+  auto cost_ms = entry.compile_cost_ms;
+  auto data = TryMakeCacheData(std::move(entry));
+  if (!data) {
+	return;
+  }
+  disk_cache_->Put(key, *data, cost_ms);
+}
+
+void LocalCache::OnTimerPurge(Poco::Timer& timer) {
+  disk_cache_->Purge();
+}
+
+void LocalCache::OnTimerPrefetch(Poco::Timer& timer) {
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_prefetch_ < kPrefetchInterval || !IsIdle()) {
+	return;
+  }
+  last_prefetch_ = now;
+  Prefetch();
+}
+
+void LocalCache::Prefetch() {
+  auto cluster = CacheCluster::Instance();
+  std::unordered_set<std::string> existing;
+  for (auto&& key : disk_cache_->GetKeys()) {
+	existing.insert(std::move(key));
+  }
+
+  // 每个节点只保存自己分片上的key，热点数按节点数平分
+  auto max_keys = (FLAGS_local_cache_prefetch_keys + cluster->GetNumNodes() - 1) / cluster->GetNumNodes();
+  std::size_t fetched = 0;
+  for (std::size_t node = 0; node < cluster->GetNumNodes() && !stopping_; ++node) {
+	grpc::ClientContext context;
+	cache::FetchHotKeysRequest req;
+	cache::FetchHotKeysResponse resp;
+	req.set_token(FLAGS_cache_server_token);
+	req.set_max_keys(max_keys);
+	SetTimeout(&context, 5s);
+	auto status = cluster->GetStub(node)->FetchHotKeys(&context, req, &resp);
+	if (!status.ok()) {
+	  LOG_WARN("RCP调用`{}`的`FetchHotKeys`失败：{}", cluster->GetLocation(node), status.error_message());
+	  continue;
+	}
+
+	// 副本的热点可能已在其他节点读到
+	std::vector<std::string> keys;
+	for (auto&& e : resp.keys()) {
+	  if (existing.insert(e.key()).second) {
+		keys.push_back(e.key());
+	  }
+	}
+
+	// 分批读取，每批之间检查是否仍然空闲，有编译任务时让出网络与磁盘
+	for (std::size_t i = 0; i < keys.size() && !stopping_ && IsIdle(); i += FLAGS_cache_max_batch_keys) {
+	  std::vector<std::string> batch(keys.begin() + i,
+	                                 keys.begin() + std::min<std::size_t>(keys.size(), i + FLAGS_cache_max_batch_keys));
+	  for (auto&& [key, entry] : CacheReader::Instance()->Prefetch(node, batch)) {
+		auto cost_ms = entry.compile_cost_ms;
+		auto data = TryMakeCacheData(std::move(entry));
+		if (data) {
+		  disk_cache_->Put(key, *data, cost_ms); // 不经过Put，预取不算编译任务的访问
+		  ++fetched;
+		}
+	  }
+	}
+  }
+  LOG_INFO("预取了 {} 个热点缓存条目到本地缓存", fetched);
+}
+
+bool LocalCache::IsIdle() const {
+  auto last_access = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(last_access_.load()));
+  return std::chrono::steady_clock::now() - last_access >= kPrefetchIdleTime &&
+         TaskMonitor::Instance()->GetRunningTasks() == 0 &&
+         cloud::Executor::Instance()->GetAllTasks().empty();
+}
+
+} // namespace distribuild::daemon::local
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <Poco/Timer.h>
+#include "cache/disk_cache.h"
+#include "daemon/cache.h"
+
+namespace distribuild::daemon::local {
+
+/// @brief 本地磁盘缓存（L0），在布隆过滤器与缓存服务器之前查询
+/// 填充来自缓存服务器的命中与servant返回的可缓存结果，来回切换分支后的增量编译只需读本地磁盘；
+/// 空闲时预取缓存服务器上的热点条目，之后第一次编译它们也不需要访问网络
+class LocalCache {
+ public:
+  static LocalCache* Instance();
+
+  LocalCache();
+  ~LocalCache();
+
+  std::optional<CacheEntry> TryGet(const std::string& key);
+
+  void Put(const std::string& key, CacheEntry entry);
+
+ private:
+  static constexpr auto kPrefetchIdleTime = std::chrono::minutes(1);    // 没有编译任务持续该时间才算空闲
+  static constexpr auto kPrefetchInterval = std::chrono::minutes(30);   // 两次预取的最小间隔
+
+  /// @brief 定时器函数，淘汰超出容量的条目
+  void OnTimerPurge(Poco::Timer& timer);
+
+  /// @brief 定时器函数，空闲时预取
+  void OnTimerPrefetch(Poco::Timer& timer);
+
+  /// @brief 从各缓存节点获取热点key，读取本地没有的条目，不再空闲时停止
+  void Prefetch();
+
+  /// @brief 本机与servant都没有正在运行的任务，且kPrefetchIdleTime内没有读写本地缓存
+  bool IsIdle() const;
+
+ private:
+  std::unique_ptr<cache::DiskCache> disk_cache_;
+  Poco::Timer timer_;
+  Poco::Timer prefetch_timer_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<std::chrono::steady_clock::rep> last_access_{}; // 最近一次编译任务读写的时间
+  std::chrono::steady_clock::time_point last_prefetch_;
+};
+
+} // namespace distribuild::daemon::local
@@ -5,8 +5,10 @@
 #include "common/spdlogging.h"
 #include "common/tools.h"
 #include "daemon/local/cache_reader.h"
+#include "daemon/local/local_cache.h"
 #include "daemon/version.h"
 #include "daemon/config.h"
+#include "daemon/dictionary_keeper.h"
 
 using namespace std::literals;
 
@@ -155,18 +157,25 @@ void TaskDispatcher::PerformTask(std::shared_ptr<TaskDesc> task_desc) {
 }
 
 bool TaskDispatcher::TryReadCache(TaskDesc* task_desc) {
-  auto cache_entry = task_desc->task->CacheControl() ?
-  					 CacheReader::Instance()->TryRead(task_desc->task->CacheKey()) :
-					 std::nullopt;
+  if (!task_desc->task->CacheControl()) {
+	return false;
+  }
+
+  // 先查本地缓存，未命中再查缓存服务器，命中后放入本地缓存
+  auto key = task_desc->task->CacheKey();
+  auto cache_entry = LocalCache::Instance()->TryGet(key);
+  if (cache_entry) {
+	hit_local_cache_.fetch_add(1, std::memory_order_relaxed);
+  } else if ((cache_entry = CacheReader::Instance()->TryRead(key))) {
+	LocalCache::Instance()->Put(key, *cache_entry);
+  }
   if (cache_entry) { // 命中缓存
-	auto files = TryUnpackFiles(cache_entry->packed);
-	if (!files) return false;
 	task_desc->output = DistTask::DistOutput {
         .exit_code = 0,
-	    .std_out = cache_entry->std_out,
-	    .std_err = cache_entry->std_err,
-		.extra_info = cache_entry->extra_info,
-	    .output_files = std::move(*files),
+	    .std_out = std::move(cache_entry->std_out),
+	    .std_err = std::move(cache_entry->std_err),
+		.extra_info = std::move(cache_entry->extra_info),
+	    .output_files = std::move(cache_entry->files),
 	  };
 	return true;
   }
@@ -279,6 +288,7 @@ void TaskDispatcher::WaitServantTask(cloud::DaemonService::Stub* stub, TaskDesc*
 		continue;
 	  } else if (result.second == 2) { // running
         retries = kRetries; // 正在运行：重新等待
+		continue;
 	  } else if (result.second == 3) { // failed
         std::scoped_lock lock(task_desc->mutex);
 		task_desc->output.exit_code = -125;
@@ -293,9 +303,20 @@ void TaskDispatcher::WaitServantTask(cloud::DaemonService::Stub* stub, TaskDesc*
 	  LOG_WARN("无法找到编译器，节点：{}，stderr：{}", task_desc->servant_location, result.first->std_err);
 	}
 
+	// servant已写入缓存的结果也放入本地缓存
+	if (result.first->exit_code == 0 && result.first->cacheable && task_desc->task->CacheControl()) {
+	  LocalCache::Instance()->Put(task_desc->task->CacheKey(), CacheEntry {
+		.exit_code  = result.first->exit_code,
+		.std_out    = result.first->std_out,
+		.std_err    = result.first->std_err,
+		.extra_info = result.first->extra_info,
+		.files      = result.first->output_files,
+	  });
+	}
+
 	std::scoped_lock lock(task_desc->mutex);
 	LOG_DEBUG("编译完成");
-	task_desc->output = *result.first;
+	task_desc->output = std::move(*result.first);
 	break;
   }
 }
@@ -313,6 +334,9 @@ std::pair<std::optional<DistTask::DistOutput>, int> TaskDispatcher::WaitServantT
   req.set_task_id(servant_task_id);
   req.set_wait_ms(2s / 1ms);
   req.add_acceptable_compress_types(cloud::CompressType::COMPRESS_TYPE_ZSTD);
+  if (DictionaryKeeper::Instance()->IsEnabled()) {
+	req.add_acceptable_compress_types(cloud::CompressType::COMPRESS_TYPE_ZSTD_DICT);
+  }
   SetTimeout(&context, 30s);
 
   // 读取数据
@@ -341,6 +365,7 @@ std::pair<std::optional<DistTask::DistOutput>, int> TaskDispatcher::WaitServantT
 	  .std_out   = resp.output(),
 	  .std_err   = resp.err(),
 	  .extra_info = resp.extra_info(),
+	  .cacheable = resp.cacheable(),
 	};
 	if (output.exit_code == 0) {
 	  auto files = TryUnpackFiles(file);
@@ -132,6 +132,7 @@ class TaskDispatcher {
   
   // 统计
   std::atomic<std::uint64_t> hit_cache_   {0};
+  std::atomic<std::uint64_t> hit_local_cache_{0}; // 其中本地缓存命中的次数
   std::atomic<std::uint64_t> existed_times{0};
   std::atomic<std::uint64_t> run_times_   {0};
 };
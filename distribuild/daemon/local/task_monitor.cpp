@@ -101,6 +101,11 @@ void TaskMonitor::DropTask(pid_t pid) {
   permission_cv_.notify_all();
 }
 
+std::size_t TaskMonitor::GetRunningTasks() {
+  std::scoped_lock lock(permission_mutex_);
+  return permissions_granted_.size();
+}
+
 void TaskMonitor::OnTimerCheckAliveProc(Poco::Timer& timer) {
   std::scoped_lock lock(permission_mutex_);
   for (auto iter = permissions_granted_.begin(); iter != permissions_granted_.end(); ) {
@@ -26,6 +26,9 @@ class TaskMonitor {
   /// @brief 
   /// @param pid 
   void DropTask(pid_t pid);
+
+  /// @brief 当前已允许（正在运行）的任务数
+  std::size_t GetRunningTasks();
  
  private:
   // 检查进程是否存活并清理
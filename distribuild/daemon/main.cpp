@@ -5,12 +5,15 @@
 #include "daemon/privilege.h"
 #include "daemon/config.h"
 #include "daemon/sysinfo.h"
+#include "daemon/cache_cluster.h"
+#include "daemon/dictionary_keeper.h"
 #include "daemon/cloud/temp_dir.h"
 #include "daemon/cloud/cache_writer.h"
 #include "daemon/cloud/compilers.h"
 #include "daemon/cloud/executor.h"
 #include "daemon/cloud/daemon_service_impl.h"
 #include "daemon/local/cache_reader.h"
+#include "daemon/local/local_cache.h"
 #include "daemon/local/file_cache.h"
 #include "daemon/local/task_monitor.h"
 #include "daemon/local/task_dispatcher.h"
@@ -44,6 +47,8 @@ int StartServer(int argc, char** argv) {
   Poco::ThreadPool::defaultPool().addCapacity(GetNumCPUCores());
 
   // 初始化单例
+  (void)CacheCluster::Instance();
+  (void)DictionaryKeeper::Instance();
   (void)cloud::CacheWriter::Instance();
   (void)cloud::Compilers::Instance();
   (void)cloud::Executor::Instance();
@@ -51,6 +56,7 @@ int StartServer(int argc, char** argv) {
   (void)local::CacheReader::Instance();
   (void)local::FileCache::Instance();
   (void)local::TaskMonitor::Instance();
+  (void)local::LocalCache::Instance(); // 预取时使用TaskMonitor、Executor与CacheReader，最后构造、最先析构
 
   LOG_INFO("缓存服务器地址: {}", FLAGS_cache_server_location);
 
@@ -82,28 +82,4 @@ inline std::size_t GetCurrentLoad(std::chrono::seconds) {
   return static_cast<std::size_t>(std::ceil(loadavg));
 }
 
-/// @brief 解析出字节数（1G、1M、1K）
-/// @param size_str_view 
-/// @return 
-inline std::size_t ParseMemorySize(const std::string_view& size_str_view) {
-  std::string size_str(size_str_view);
-  std::uint64_t scale = 1;
-
-  if (size_str.back() == 'G') {
-    scale = 1 << 30;
-    size_str.pop_back();
-  } else if (size_str.back() == 'M') {
-    scale = 1 << 20;
-    size_str.pop_back();
-  } else if (size_str.back() == 'K') {
-    scale = 1 << 10;
-    size_str.pop_back();
-  } else if (size_str.back() == 'B') {
-    size_str.pop_back();
-  }
-  // 默认为字节数
-
-  return std::stoul(size_str) * scale;
-}
-
 } // namespace distribuild::daemon
\ No newline at end of file
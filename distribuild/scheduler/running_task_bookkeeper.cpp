@@ -4,22 +4,47 @@ namespace distribuild::scheduler {
 
 void RunningTaskBookkeeper::SetRunningTask(const std::string& location, std::vector<RunningTask> tasks) {
   std::scoped_lock lock(mutex_);
-  running_tasks_.erase(location);
-  running_tasks_.emplace(location, std::move(tasks));
+  running_tasks_[location] = std::move(tasks);
+  version_.fetch_add(1, std::memory_order_relaxed);
 }
 
 void RunningTaskBookkeeper::DelServant(const std::string& location) {
   std::scoped_lock lock(mutex_);
   running_tasks_.erase(location);
+  version_.fetch_add(1, std::memory_order_relaxed);
 }
 
-std::vector<RunningTask> RunningTaskBookkeeper::GetRunningTasks() const {
-  std::vector<RunningTask> result;
-  std::scoped_lock lock(mutex_);
-  for (auto&& [k, v] : running_tasks_) {
-    result.insert(result.begin(), v.begin(), v.end());
+std::shared_ptr<const std::vector<RunningTask>> RunningTaskBookkeeper::GetRunningTasks() const {
+  auto is_fresh = [this](const std::shared_ptr<const Snapshot>& snapshot) {
+    return snapshot && (snapshot->version == version_.load(std::memory_order_relaxed) ||
+                        std::chrono::steady_clock::now() - snapshot->built_tp < kSnapshotInterval);
+  };
+
+  auto snapshot = snapshot_.load();
+  if (!is_fresh(snapshot)) {
+    // 已有读者在重建时直接使用旧快照
+    std::unique_lock rebuild_lock(snapshot_mutex_, std::try_to_lock);
+    if (!rebuild_lock && !snapshot) {
+      rebuild_lock.lock();
+    }
+    if (rebuild_lock) {
+      snapshot = snapshot_.load();
+      if (!is_fresh(snapshot)) {
+        auto rebuilt = std::make_shared<Snapshot>();
+        {
+          std::scoped_lock lock(mutex_);
+          rebuilt->version = version_.load(std::memory_order_relaxed);
+          for (auto&& [k, v] : running_tasks_) {
+            rebuilt->tasks.insert(rebuilt->tasks.end(), v.begin(), v.end());
+          }
+        }
+        rebuilt->built_tp = std::chrono::steady_clock::now();
+        snapshot_.store(rebuilt);
+        snapshot = std::move(rebuilt);
+      }
+    }
   }
-  return result;
+  return std::shared_ptr<const std::vector<RunningTask>>(snapshot, &snapshot->tasks);
 }
 
-}
\ No newline at end of file
+}
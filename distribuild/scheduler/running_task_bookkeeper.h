@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <unordered_map>
 #include <mutex>
 #include <vector>
@@ -9,6 +12,7 @@
 namespace distribuild::scheduler {
 
 /// @brief 记录每个节点地址正在运行的任务
+/// 心跳只更新对应节点的列表；读者使用定时重建的快照，不与心跳争抢锁
 class RunningTaskBookkeeper {
  public:
 
@@ -21,15 +25,31 @@ class RunningTaskBookkeeper {
   /// @param location 
   void DelServant(const std::string& location);
 
-  /// @brief 获取当前所有任务
-  /// @return 
-  std::vector<RunningTask> GetRunningTasks() const;
+  /// @brief 获取当前所有任务，有变化时最多每kSnapshotInterval重建一次快照
+  /// @return 只读快照，可能比最新状态旧kSnapshotInterval
+  std::shared_ptr<const std::vector<RunningTask>> GetRunningTasks() const;
 
  private:
+  static constexpr auto kSnapshotInterval = std::chrono::seconds(1);
+
+  /// @brief 所有任务的快照
+  struct Snapshot {
+    std::uint64_t version;                          // 构建时的版本
+    std::chrono::steady_clock::time_point built_tp; // 构建时间
+    std::vector<RunningTask> tasks;
+  };
+
   mutable std::mutex mutex_;
 
   /// @brief location节点正在运行的任务列表
   std::unordered_map<std::string, std::vector<RunningTask>> running_tasks_;
+
+  /// @brief running_tasks_每次修改加一
+  std::atomic<std::uint64_t> version_{};
+
+  /// @brief 同一时间只有一个读者重建快照，其他读者继续使用旧快照
+  mutable std::mutex snapshot_mutex_;
+  mutable std::atomic<std::shared_ptr<const Snapshot>> snapshot_;
 };
 
-} // namespace distribuild::scheduler
\ No newline at end of file
+} // namespace distribuild::scheduler
@@ -237,8 +237,11 @@ grpc::Status SchedulerServiceImpl::KeepTaskAlive(
 	return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "时间过长");
   }
 
-  for (auto&& task_id : request->task_grant_ids()) {
-	response->add_statues(TaskDispatcher::Instance()->KeepTaskAlive(task_id, next_keep_alive));
+  // 一次加锁处理所有任务
+  auto statuses = TaskDispatcher::Instance()->KeepTaskAlive(
+	{request->task_grant_ids().begin(), request->task_grant_ids().end()}, next_keep_alive);
+  for (auto&& status : statuses) {
+	response->add_statues(status);
   }
 
   return grpc::Status::OK;
@@ -250,15 +253,15 @@ grpc::Status SchedulerServiceImpl::FreeTask(grpc::ServerContext *context, const
   if (!user_token_verifier_->Verify(request->token())) {
 	return grpc::Status(grpc::StatusCode::PERMISSION_DENIED, "Token验证失败");
   }
-  for (auto&& task_id : request->task_grant_ids()) {
-    TaskDispatcher::Instance()->FreeTask(task_id);
-  }
+  TaskDispatcher::Instance()->FreeTask({request->task_grant_ids().begin(), request->task_grant_ids().end()});
   return grpc::Status::OK;
 }
 
 grpc::Status SchedulerServiceImpl::GetRunningTasks(grpc::ServerContext *context, const GetRunningTasksRequest *request, GetRunningTasksResponse *response) {
-  for (auto&& running_task : TaskDispatcher::Instance()->GetRunningTasks()) {
-    *response->add_running_tasks() = std::move(running_task);
+  // 快照由所有调用者共享，只能复制
+  auto running_tasks = TaskDispatcher::Instance()->GetRunningTasks();
+  for (auto&& running_task : *running_tasks) {
+    *response->add_running_tasks() = running_task;
   }
   return grpc::Status::OK;
 }
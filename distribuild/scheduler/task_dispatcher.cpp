@@ -2,6 +2,7 @@
 #include "common/spdlogging.h"
 #include "common/tools.h"
 #include <gflags/gflags.h>
+#include <algorithm>
 
 using namespace std::literals;
 
@@ -31,29 +32,40 @@ TaskDispatcher::WaitForStartingNewTask(
     std::chrono::steady_clock::time_point timeout, bool prefetching) {
   std::unique_lock lock(alloc_mutex_);
 
-  std::vector<Servant::Ptr> free_servants;
-  while (true) {
-	// 找到有对应编译器的节点
-	auto servants_has_env = UnsafeGetServantsHasEnv(task_info);
-	if (servants_has_env.empty()) {
-	  return {std::nullopt, WaitStatus::EnvNotFound};
-	}
-	// 找到空闲的机器
-	free_servants = UnsafeGetFreeServants(servants_has_env);
-	if (!free_servants.empty()) {
-      break; // 找到退出
-	}
-    // 无可用机器，等待空闲机器
-	if (alloc_cv_.wait_until(lock, timeout) == std::cv_status::timeout) {
-	  LOG_INFO("暂无可用机器");
-	  return {std::nullopt, WaitStatus::Timeout};
-	}
+  // 排到该编译器等待队列的末尾，能分配时按先来后到直接交给队首的请求，不会插队
+  Waiter waiter{.task_info = &task_info, .expires_in = expires_in, .prefetching = prefetching};
+  auto&& digest = task_info.env_desc.compiler_digest();
+  auto&& queue = waiters_[digest];
+  auto pos = queue.insert(queue.end(), &waiter);
+  UnsafeServeWaiters(digest);
+  if (waiter.allocation) {
+	return {std::move(waiter.allocation), WaitStatus::OK};
   }
 
-  // 挑选一个可用的节点
-  auto picked = UnsafePickUpFreeServant(free_servants, task_info.requester_ip);
+  // 没有空闲节点时才检查是否有对应编译器的节点
+  auto status = WaitStatus::Timeout;
+  if (UnsafeGetServantsHasEnv(task_info).empty()) {
+	status = WaitStatus::EnvNotFound;
+  } else if (waiter.cv.wait_until(lock, timeout, [&] { return waiter.allocation.has_value(); })) {
+	return {std::move(waiter.allocation), WaitStatus::OK}; // 分配者已将其移出队列
+  } else {
+	LOG_INFO("暂无可用机器");
+  }
+
+  // 超时或无编译器，自己移出队列
+  auto iter = waiters_.find(digest);
+  iter->second.erase(pos);
+  if (iter->second.empty()) {
+	waiters_.erase(iter);
+  }
+  return {std::nullopt, status};
+}
+
+TaskAllocation TaskDispatcher::UnsafeAllocate(const Servant::Ptr& picked, const TaskInfo& task_info,
+                                              std::chrono::milliseconds expires_in, bool prefetching) {
   ++picked->running_tasks;
   ++picked->assigned_tasks;
+  UnsafeUpdateRank(picked);
 
   // 创建新任务
   auto task_id = next_task_id_.fetch_add(1, std::memory_order_relaxed);
@@ -62,32 +74,58 @@ TaskDispatcher::WaitForStartingNewTask(
   auto&& new_task = tasks_[task_id];
   new_task.task_id = task_id;
   new_task.task_info = task_info;
-  new_task.servant = std::shared_ptr<Servant>(picked);
+  new_task.servant = picked;
   new_task.started_tp = std::chrono::steady_clock::now();
   new_task.expires_tp = new_task.started_tp + expires_in;
   new_task.is_prefetch = prefetching;
+  picked->task_ids.insert(task_id);
+  expirations_.emplace(new_task.expires_tp, task_id);
 
-  return {{TaskAllocation{.task_id = task_id, .servant_location = picked->servant_info.observed_location}}, WaitStatus::OK};
+  return TaskAllocation{.task_id = task_id, .servant_location = picked->servant_info.observed_location};
+}
+
+void TaskDispatcher::UnsafeServeWaiters(const std::string& digest) {
+  auto iter = waiters_.find(digest);
+  if (iter == waiters_.end()) {
+	return;
+  }
+
+  auto&& queue = iter->second;
+  for (auto waiter = queue.begin(); waiter != queue.end() && free_servants_.count(digest); ) {
+	auto picked = UnsafePickUpFreeServant(*(*waiter)->task_info);
+	if (!picked) {
+	  ++waiter; // 只有版本不符的空闲节点，后面的请求可能可以使用
+	  continue;
+	}
+	(*waiter)->allocation = UnsafeAllocate(picked, *(*waiter)->task_info, (*waiter)->expires_in, (*waiter)->prefetching);
+	(*waiter)->cv.notify_one();
+	waiter = queue.erase(waiter);
+  }
+  if (queue.empty()) {
+	waiters_.erase(iter);
+  }
+}
+
+void TaskDispatcher::UnsafeServeWaiters(const Servant::Ptr& servant) {
+  if (!servant->rank) {
+	return; // 没有空闲
+  }
+  for (auto&& env : servant->servant_info.env_decs) {
+	UnsafeServeWaiters(env.compiler_digest());
+  }
 }
 
 std::vector<TaskDispatcher::Servant::Ptr> TaskDispatcher::UnsafeGetServantsHasEnv(const TaskInfo& task_info) {
   std::vector<Servant::Ptr> eligible_servants;
 
-  // 寻找可用节点
-  for (auto&& servant : servants_) {
-	auto find_env = [servant, task_info] () {
-	  for (auto&& env : servant->servant_info.env_decs) {
-		if (env.compiler_digest() == task_info.env_desc.compiler_digest()) {
-		  return true;
-		}
-	  }
-	  return false;
-	};
+  // 只在有对应编译器的节点中寻找
+  auto iter = env_servants_.find(task_info.env_desc.compiler_digest());
+  if (iter == env_servants_.end()) {
+	LOG_WARN("来自 '{}' 没有对应的 '{}' 编译器环境，或者没有可用节点", task_info.requester_ip, task_info.env_desc.compiler_digest());
+	return eligible_servants;
+  }
 
-	if (!find_env()) {
-	  // 节点无对应编译器
-	  continue;
-	}
+  for (auto&& servant : iter->second) {
 	if (servant->servant_info.concurrency <= 0) {
 	  // 节点不接受任务
 	  continue;
@@ -107,50 +145,96 @@ std::vector<TaskDispatcher::Servant::Ptr> TaskDispatcher::UnsafeGetServantsHasEn
   return eligible_servants;
 }
 
-std::vector<TaskDispatcher::Servant::Ptr> TaskDispatcher::UnsafeGetFreeServants(const std::vector<Servant::Ptr> &eligible_servants) {
-  std::vector<Servant::Ptr> free_servants;
-  for (auto&& servant : eligible_servants) {
-	if (servant->running_tasks >= AvailableTasks(servant)) {
-	  LOG_DEBUG("servant->running_tasks = {}, AvailableTasks(servant) = {}", servant->running_tasks, AvailableTasks(servant));
-	  // 忙
+TaskDispatcher::Servant::Ptr TaskDispatcher::UnsafePickUpFreeServant(const TaskInfo& task_info) {
+  auto iter = free_servants_.find(task_info.env_desc.compiler_digest());
+  if (iter == free_servants_.end()) {
+	return nullptr;
+  }
+
+  // 排在前面的就是专用节点优先、利用率最低的节点，通常第一个即可使用
+  Servant* self = nullptr;
+  auto&& requestor_ip = task_info.requester_ip;
+  for (auto&& rank : iter->second) {
+	auto servant = rank.servant;
+	if (servant->servant_info.version > task_info.min_version) {
+	  // 小于节点版本
+	  continue;
+	}
+	// 是否是ip相同的节点
+	if (servant->servant_info.observed_location.size() > requestor_ip.size() &&
+	    servant->servant_info.observed_location[requestor_ip.size()] == ':' &&
+	    StartWith(servant->servant_info.observed_location, requestor_ip)) {
+	  self = self ? self : servant;
 	  continue;
 	}
-	free_servants.push_back(servant);
+	return servant->shared_from_this();
   }
-  return free_servants;
+
+  // 没办法，只能使用自己
+  if (self) {
+	LOG_DEBUG("使用了自己");
+	return self->shared_from_this();
+  }
+  return nullptr;
 }
 
-TaskDispatcher::Servant::Ptr TaskDispatcher::UnsafePickUpFreeServant(std::vector<Servant::Ptr> &free_servants, const std::string &requestor_ip) {
-  Servant::Ptr self = nullptr;
+void TaskDispatcher::UnsafeUpdateRank(const Servant::Ptr& servant) {
+  std::optional<ServantRank> rank;
+  if (!servant->expired && servant->running_tasks < AvailableTasks(servant)) {
+	auto&& info = servant->servant_info;
+	rank = ServantRank{
+	  .priority_class = info.priority == ServantPriority::SERVANT_PRIORITY_DEDICATED &&
+	                    info.concurrency > 2 * servant->running_tasks ? 0 : 1,
+	  .utilization    = double(servant->running_tasks) / info.concurrency, // 线程利用率
+	  .servant        = servant.get(),
+	};
+  }
+  UnsafeSetRank(servant, rank);
+}
 
-  // 查找是否有ip相同的节点
-  auto iter = std::find_if(free_servants.begin(), free_servants.end(), [&](auto&& servant){
-    return servant->servant_info.observed_location.size() > requestor_ip.size() &&
-	       servant->servant_info.observed_location[requestor_ip.size()] == ':' &&
-		   StartWith(servant->servant_info.observed_location, requestor_ip);
-  });
-  if (iter != free_servants.end()) {
-	self = *iter;
-	free_servants.erase(iter);
+void TaskDispatcher::UnsafeSetRank(const Servant::Ptr& servant, std::optional<ServantRank> rank) {
+  if (rank == servant->rank) {
+	return;
   }
 
-  // 寻找是否有专用编译节点，优先使用
-  if (auto ptr = UnsafePickUpServant(free_servants, [](Servant::Ptr servant){ 
-	    return servant->servant_info.priority == ServantPriority::SERVANT_PRIORITY_DEDICATED &&  
-			   servant->servant_info.concurrency > 2 * servant->running_tasks; })) {
-    return ptr;
+  for (auto&& env : servant->servant_info.env_decs) {
+	if (servant->rank) {
+	  auto iter = free_servants_.find(env.compiler_digest());
+	  if (iter != free_servants_.end()) {
+		iter->second.erase(*servant->rank);
+		if (iter->second.empty()) {
+		  free_servants_.erase(iter);
+		}
+	  }
+	}
+	if (rank) {
+	  free_servants_[env.compiler_digest()].insert(*rank);
+	}
   }
-  
-  // 是否有其它可用节点
-  if (auto ptr = UnsafePickUpServant(free_servants, [](Servant::Ptr servant){ return true; })) {
-    return ptr;
+  servant->rank = rank;
+}
+
+void TaskDispatcher::UnsafeIndexServant(const Servant::Ptr& servant) {
+  for (auto&& env : servant->servant_info.env_decs) {
+	env_servants_[env.compiler_digest()].insert(servant);
   }
+  UnsafeUpdateRank(servant);
+}
 
-  // 没办法，只能使用自己
-  LOG_DEBUG("使用了自己");
-  DISTBU_CHECK(self);
-  DISTBU_CHECK(AvailableTasks(self) != 0);
-  return self;
+void TaskDispatcher::UnsafeUnindexServant(const Servant::Ptr& servant) {
+  // 先按原编译器列表移出free_servants_
+  UnsafeSetRank(servant, std::nullopt);
+
+  for (auto&& env : servant->servant_info.env_decs) {
+	auto iter = env_servants_.find(env.compiler_digest());
+	if (iter == env_servants_.end()) {
+	  continue;
+	}
+	iter->second.erase(servant);
+	if (iter->second.empty()) {
+	  env_servants_.erase(iter);
+	}
+  }
 }
 
 size_t TaskDispatcher::AvailableTasks(const Servant::Ptr servant) {
@@ -170,20 +254,29 @@ void TaskDispatcher::UnsafeClearZombies(const Servant::Ptr servant, const std::u
   std::size_t non_prefetch_zombies = 0;
   std::vector<std::uint64_t> clearing_task_ids;
 
-  for (auto&& iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
-	if (iter->second.servant == servant && 
-	    iter->second.is_zombie &&
-		running_task_ids.count(iter->second.task_id) == 0) {
-      clearing_task_ids.push_back(iter->first);
-	  non_prefetch_zombies += !iter->second.is_prefetch;
+  // 只遍历该节点的任务
+  for (auto&& task_id : servant->task_ids) {
+	auto&& task = tasks_.at(task_id);
+	if (task.is_zombie && running_task_ids.count(task_id) == 0) {
+      clearing_task_ids.push_back(task_id);
+	  non_prefetch_zombies += !task.is_prefetch;
 	}
   }
 
   UnsafeFreeTask(clearing_task_ids);
 }
 
-bool TaskDispatcher::KeepTaskAlive(std::uint64_t task_id, std::chrono::milliseconds expire_time) {
+std::vector<bool> TaskDispatcher::KeepTaskAlive(const std::vector<std::uint64_t>& task_ids, std::chrono::milliseconds expire_time) {
+  std::vector<bool> result;
+  result.reserve(task_ids.size());
   std::scoped_lock _(alloc_mutex_);
+  for (auto&& task_id : task_ids) {
+	result.push_back(UnsafeKeepTaskAlive(task_id, expire_time));
+  }
+  return result;
+}
+
+bool TaskDispatcher::UnsafeKeepTaskAlive(std::uint64_t task_id, std::chrono::milliseconds expire_time) {
   auto iter = tasks_.find(task_id);
   if (iter == tasks_.end()) {
 	LOG_WARN("正在更新未知任务 '{}'.", task_id);
@@ -199,28 +292,42 @@ bool TaskDispatcher::KeepTaskAlive(std::uint64_t task_id, std::chrono::milliseco
   return true;
 }
 
-void TaskDispatcher::FreeTask(std::uint64_t task_id) {
+void TaskDispatcher::FreeTask(const std::vector<std::uint64_t>& task_ids) {
   std::scoped_lock _(alloc_mutex_);
-  UnsafeFreeTask({task_id});
+  UnsafeFreeTask(task_ids);
 }
 
 void TaskDispatcher::KeepServantAlive(const ServantInfo& servant_info, std::chrono::milliseconds expire_time) {
   std::scoped_lock _(alloc_mutex_);
   // 节点是否存在
-  for (auto&& servant : servants_) {
-	if (servant->servant_info.observed_location == servant_info.observed_location) {
-	  // 找到存在的节点，进行更新
-	  servant->servant_info = servant_info;
-	  servant->expires_tp = std::chrono::steady_clock::now() + expire_time;
-	  return;
+  auto&& servant = servants_[servant_info.observed_location];
+  if (servant) {
+	// 找到存在的节点，进行更新；编译器列表通常不变，变化时才更新索引
+	auto same_envs = std::equal(
+	  servant->servant_info.env_decs.begin(), servant->servant_info.env_decs.end(),
+	  servant_info.env_decs.begin(), servant_info.env_decs.end(),
+	  [](auto&& x, auto&& y) { return x.compiler_digest() == y.compiler_digest(); });
+	if (!same_envs) {
+	  UnsafeUnindexServant(servant);
 	}
+	servant->servant_info = servant_info;
+	servant->expires_tp = std::chrono::steady_clock::now() + expire_time;
+	if (!same_envs) {
+	  UnsafeIndexServant(servant);
+	} else {
+	  UnsafeUpdateRank(servant); // 负载、内存可能变化
+	}
+	UnsafeServeWaiters(servant);
+	return;
   }
 
   // 节点不存在，新增
-  auto&& new_servant = servants_.emplace_back(std::make_shared<Servant>());
-  new_servant->servant_info = servant_info;
-  new_servant->discovered_tp = std::chrono::steady_clock::now();
-  new_servant->expires_tp = new_servant->discovered_tp + expire_time;
+  servant = std::make_shared<Servant>();
+  servant->servant_info = servant_info;
+  servant->discovered_tp = std::chrono::steady_clock::now();
+  servant->expires_tp = servant->discovered_tp + expire_time;
+  UnsafeIndexServant(servant);
+  UnsafeServeWaiters(servant);
 
   // 任务数默认为0
   if (servant_info.observed_location != servant_info.reported_location) {
@@ -243,26 +350,21 @@ std::vector<std::uint64_t> TaskDispatcher::NotifyServantRunningTasks(
 
   std::scoped_lock _(alloc_mutex_);
   // 找到目标节点
-  Servant::Ptr servant = nullptr;
-  for (auto&& e : servants_) {
-	if (e->servant_info.observed_location == servant_location) {
-	  servant = e;
-	  break;
-	}
-  }
+  auto servant_iter = servants_.find(servant_location);
 
   // 节点已经过期
-  if (!servant) {
+  if (servant_iter == servants_.end()) {
 	return task_grant_ids;
   }
+  auto servant = servant_iter->second;
 
   // 清除僵尸任务
   UnsafeClearZombies(servant, {task_grant_ids.begin(), task_grant_ids.end()});
 
   // 找到对应节点允许运行的任务
   std::unordered_set<std::uint64_t> permitted_task_ids;
-  for (auto&& [id, task] : tasks_) {
-	if (task.servant == servant && !task.is_zombie) {
+  for (auto&& id : servant->task_ids) {
+	if (!tasks_.at(id).is_zombie) {
 	  permitted_task_ids.insert(id);
 	}
   }
@@ -283,23 +385,30 @@ std::vector<std::uint64_t> TaskDispatcher::NotifyServantRunningTasks(
   return unknown_tasks;
 }
 
-std::vector<RunningTask> TaskDispatcher::GetRunningTasks() const {
+std::shared_ptr<const std::vector<RunningTask>> TaskDispatcher::GetRunningTasks() const {
 	return running_task_bookkeeper_.GetRunningTasks();
 }
 
 void TaskDispatcher::UnsafeFreeTask(const std::vector<std::uint64_t> &task_ids) {
   // 遍历要删除的任务编号
+  std::vector<Servant::Ptr> freed_servants;
   for (auto &&id : task_ids) {
   	// 找到要删除的任务
   	auto iter = tasks_.find(id);
   	if (iter == tasks_.end()) {
   		LOG_WARN("正在释放未知的任务 '{}'", id);
-  		return;
+  		continue;
   	}
+  	iter->second.servant->task_ids.erase(id);
   	--iter->second.servant->running_tasks; // 减少所分配节点的任务数
+  	UnsafeUpdateRank(iter->second.servant);
+  	freed_servants.push_back(iter->second.servant);
   	DISTBU_CHECK(tasks_.erase(id) == 1);   // 从任务表中删除
   }
-  alloc_cv_.notify_all();
+  // 释放的名额交给这些节点上各编译器等待最久的请求
+  for (auto&& servant : freed_servants) {
+	UnsafeServeWaiters(servant);
+  }
 }
 
 void TaskDispatcher::OnTimerExpiration(Poco::Timer& timer) {
@@ -307,41 +416,39 @@ void TaskDispatcher::OnTimerExpiration(Poco::Timer& timer) {
 //   LOG_DEBUG("定时器触发 OnTimerExpiration");
 
   std::scoped_lock _(alloc_mutex_);
-  // 过期节点直接移除
+  // 过期节点直接移除，同时清除其所属的任务
+  std::vector<std::uint64_t> clearing_task_ids;
   for (auto iter = servants_.begin(); iter != servants_.end(); ) {
-    if ((*iter)->expires_tp < now) {
-	  LOG_INFO("移除超时节点：'{}'", (*iter)->servant_info.observed_location);
-	  running_task_bookkeeper_.DelServant((*iter)->servant_info.observed_location);
+    if (iter->second->expires_tp < now) {
+	  LOG_INFO("移除超时节点：'{}'", iter->first);
+	  running_task_bookkeeper_.DelServant(iter->first);
+	  iter->second->expired = true; // 之后释放其任务时不再加入free_servants_
+	  UnsafeUnindexServant(iter->second);
+	  clearing_task_ids.insert(clearing_task_ids.end(), iter->second->task_ids.begin(), iter->second->task_ids.end());
 	  iter = servants_.erase(iter);
 	} else {
 	  ++iter;
 	}
   }
-
-  // 清除过期节点所属的任务
-  {
-    std::vector<std::uint64_t> clearing_task_ids;
-	std::unordered_set<Servant*> alive_servants;
-	for (auto servant : servants_) {
-	  alive_servants.insert(servant.get());
-	}
-	for (auto&& [id, task] : tasks_) {
-      if (alive_servants.count(task.servant.get()) == 0) {
-        clearing_task_ids.push_back(id);
-	  }
-	}
-	if (!clearing_task_ids.empty()) {
-	  LOG_INFO("移除 {} 个任务", clearing_task_ids.size());
-	}
+  if (!clearing_task_ids.empty()) {
+	LOG_INFO("移除 {} 个任务", clearing_task_ids.size());
 	UnsafeFreeTask(clearing_task_ids);
   }
 
-  // 过期任务标记为僵尸任务
-  for (auto iter = tasks_.begin(); iter != tasks_.end(); ++iter) {
-	if (iter->second.expires_tp < now) {
-	  iter->second.is_zombie = true;
-	  LOG_INFO("任务 '{}' 超时，", iter->first);
+  // 过期任务标记为僵尸任务，只弹出到期的项
+  while (!expirations_.empty() && expirations_.top().first < now) {
+	auto task_id = expirations_.top().second;
+	expirations_.pop();
+	auto iter = tasks_.find(task_id);
+	if (iter == tasks_.end() || iter->second.is_zombie) {
+	  continue; // 已释放
+	}
+	if (iter->second.expires_tp >= now) {
+	  expirations_.emplace(iter->second.expires_tp, task_id); // 期间被延长过
+	  continue;
 	}
+	iter->second.is_zombie = true;
+	LOG_INFO("任务 '{}' 超时，", task_id);
   }
 }
 
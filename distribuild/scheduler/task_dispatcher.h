@@ -1,12 +1,16 @@
 #pragma once
 
 #include <atomic>
+#include <set>
 #include <string>
 #include <vector>
 #include <chrono>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <queue>
 #include <condition_variable>
+#include <list>
 #include <optional>
 #include <Poco/Timer.h>
 #include "scheduler/running_task_bookkeeper.h"
@@ -57,15 +61,15 @@ class TaskDispatcher {
   std::pair<std::optional<TaskAllocation>, WaitStatus> WaitForStartingNewTask(const TaskInfo& task_info, std::chrono::milliseconds expires_in,
       std::chrono::steady_clock::time_point timeout, bool prefetching);
 
-  /// @brief 延长任务超时时间
-  /// @param task_id 
+  /// @brief 延长多个任务的超时时间，只加一次锁
+  /// @param task_ids 
   /// @param new_expire_time 
-  /// @return 
-  bool KeepTaskAlive(std::uint64_t task_id, std::chrono::milliseconds new_expire_time);
+  /// @return 每个任务是否延长成功
+  std::vector<bool> KeepTaskAlive(const std::vector<std::uint64_t>& task_ids, std::chrono::milliseconds new_expire_time);
 
-  /// @brief 释放任务
-  /// @param task_id 
-  void FreeTask(std::uint64_t task_id);
+  /// @brief 释放多个任务，只加一次锁
+  /// @param task_ids 
+  void FreeTask(const std::vector<std::uint64_t>& task_ids);
 
   /// @brief 设置一个现有节点或新节点的超时时间
   /// @param servant 
@@ -78,12 +82,23 @@ class TaskDispatcher {
   /// @return 
   std::vector<std::uint64_t> NotifyServantRunningTasks(const std::string& servant_location, std::vector<RunningTask> tasks);
 
-  /// @brief 
-  /// @return 
-  std::vector<RunningTask> GetRunningTasks() const;
+  /// @brief 获取所有节点正在运行的任务，不加alloc_mutex_
+  /// @return 只读快照
+  std::shared_ptr<const std::vector<RunningTask>> GetRunningTasks() const;
 
  private:
 
+  struct Servant;
+
+  /// @brief 空闲节点的排序键，小的优先：专用且利用率低于一半的节点在前，同一类中利用率低的在前
+  struct ServantRank {
+    int priority_class;   // 0：专用且利用率低于一半，1：其他
+    double utilization;   // running_tasks / concurrency
+    Servant* servant;     // 相同时按地址区分
+
+    auto operator<=>(const ServantRank&) const = default;
+  };
+
   // 保存在task中和servants中
   struct Servant : public std::enable_shared_from_this<Servant> {
 	using Ptr = std::shared_ptr<Servant>;
@@ -93,6 +108,9 @@ class TaskDispatcher {
 	std::chrono::steady_clock::time_point expires_tp;    // 超时时间点
     std::size_t running_tasks  = 0;  // 正在运行的任务数
     std::size_t assigned_tasks = 0;  // 被分配过的任务总数
+    std::optional<ServantRank> rank; // 在free_servants_中的排序键，不空闲时为空
+    bool expired = false;            // 已过期并移除
+    std::unordered_set<std::uint64_t> task_ids; // 分配给该节点、尚未释放的任务
   };
 
   struct Task {
@@ -105,39 +123,75 @@ class TaskDispatcher {
 	bool is_zombie = false;
   };
 
+  /// @brief 阻塞在WaitForStartingNewTask中的请求
+  struct Waiter {
+    const TaskInfo* task_info;
+    std::chrono::milliseconds expires_in;
+    bool prefetching;
+    std::condition_variable cv;
+    std::optional<TaskAllocation> allocation; // 分配者设置后将其移出队列并唤醒
+  };
+
+  /// @brief （无锁）在picked上创建任务
+  /// @param picked 
+  /// @param task_info 
+  /// @param expires_in 
+  /// @param prefetching 
+  /// @return 
+  TaskAllocation UnsafeAllocate(const Servant::Ptr& picked, const TaskInfo& task_info,
+                                std::chrono::milliseconds expires_in, bool prefetching);
+
+  /// @brief （无锁）按先来后到把空闲名额分配给该编译器的等待者，跳过暂时无法满足的（版本不符），直到没有空闲节点
+  /// @param digest 编译器摘要
+  void UnsafeServeWaiters(const std::string& digest);
+
+  /// @brief （无锁）servant有空闲时，为它的每个编译器分配等待者
+  /// @param servant 
+  void UnsafeServeWaiters(const Servant::Ptr& servant);
+
   /// @brief （无锁）获得拥有task运行环境的节点
   /// @param task_info 
   /// @return 
   std::vector<Servant::Ptr> UnsafeGetServantsHasEnv(const TaskInfo& task_info);
 
-  /// @brief （无锁）获得空闲节点
+  /// @brief （无锁）从有对应编译器的空闲节点中按排序挑选一个，请求者自己的节点只在没有其他节点时使用
   /// @param task_info 
-  /// @return 
-  std::vector<Servant::Ptr> UnsafeGetFreeServants(const std::vector<Servant::Ptr> &eligible_servants);
+  /// @return 没有空闲节点时为空
+  Servant::Ptr UnsafePickUpFreeServant(const TaskInfo& task_info);
 
-  /// @brief （无锁）从中挑选一个节点
-  /// @param free_servants 
-  /// @return 
-  Servant::Ptr UnsafePickUpFreeServant(std::vector<Servant::Ptr> &free_servants, const std::string& requestor);
+  /// @brief （无锁）节点的任务数或信息变化后，重新计算其排序键并更新free_servants_
+  /// @param servant 
+  void UnsafeUpdateRank(const Servant::Ptr& servant);
 
-  /// @brief （无锁）从中使用过滤函数挑选一个负载最小的节点
-  /// @tparam F 
-  /// @param free_servants 
-  /// @param filter 过滤函数，返回false的节点不能使用
-  /// @return 
-  template<class F>
-  Servant::Ptr UnsafePickUpServant(std::vector<Servant::Ptr> &free_servants, F&& filter);
+  /// @brief （无锁）按节点当前的编译器列表，把它在free_servants_中的排序键换成rank，为空则移出
+  /// @param servant 
+  /// @param rank 
+  void UnsafeSetRank(const Servant::Ptr& servant, std::optional<ServantRank> rank);
+
+  /// @brief （无锁）加入编译器索引
+  /// @param servant 
+  void UnsafeIndexServant(const Servant::Ptr& servant);
+
+  /// @brief （无锁）从编译器索引中移除
+  /// @param servant 
+  void UnsafeUnindexServant(const Servant::Ptr& servant);
 
   /// @brief 可用任务数
   /// @param servant 
   /// @return 
   size_t AvailableTasks(const Servant::Ptr servant);
 
-  /// @brief （无锁）从所有任务中删去属于servant的running_task_ids的任务
+  /// @brief （无锁）删去servant上已是僵尸且不在running_task_ids中的任务
   /// @param servant 
   /// @param running_task_ids 
   void UnsafeClearZombies(const Servant::Ptr servant, const std::unordered_set<std::uint64_t>& running_task_ids);
 
+  /// @brief （无锁）延长任务超时时间
+  /// @param task_id 
+  /// @param new_expire_time 
+  /// @return 
+  bool UnsafeKeepTaskAlive(std::uint64_t task_id, std::chrono::milliseconds new_expire_time);
+
   /// @brief （无锁）删去任务
   /// @param task_ids 
   void UnsafeFreeTask(const std::vector<std::uint64_t>& task_ids);
@@ -150,14 +204,26 @@ class TaskDispatcher {
 
   std::mutex alloc_mutex_;
 
-  std::condition_variable alloc_cv_;
+  /// @brief 编译器摘要 -> 等待分配的请求，先进先出，每个请求在自己的条件变量上等待
+  std::unordered_map<std::string, std::list<Waiter*>> waiters_;
 
-  /// @brief 当前节点
-  std::vector<Servant::Ptr> servants_;
+  /// @brief 当前节点，观测地址 -> 节点
+  std::unordered_map<std::string, Servant::Ptr> servants_;
+
+  /// @brief 编译器摘要 -> 拥有该编译器的节点，随心跳与节点过期增量维护
+  std::unordered_map<std::string, std::unordered_set<Servant::Ptr>> env_servants_;
+
+  /// @brief 编译器摘要 -> 有空闲的节点，按ServantRank排序，随分配、释放与心跳更新
+  std::unordered_map<std::string, std::set<ServantRank>> free_servants_;
 
   /// @brief 正在运行的所有任务
   std::unordered_map<std::uint64_t, Task> tasks_;
 
+  /// @brief (过期时间, 任务id)的小顶堆，每个未过期的任务一项
+  /// 延长任务时不更新，到期弹出时若任务已被延长则按新的过期时间重新加入
+  using Expiration = std::pair<std::chrono::steady_clock::time_point, std::uint64_t>;
+  std::priority_queue<Expiration, std::vector<Expiration>, std::greater<Expiration>> expirations_;
+
   /// @brief 任务唯一id
   std::atomic<std::uint64_t> next_task_id_{};
   
@@ -168,25 +234,4 @@ class TaskDispatcher {
   std::uint64_t min_memory_for_new_task_;
 };
 
-template <class F>
-inline TaskDispatcher::Servant::Ptr TaskDispatcher::UnsafePickUpServant(std::vector<Servant::Ptr> &servants, F &&filter) {
-  if (servants.empty()) return nullptr;
-
-  Servant::Ptr result = servants[0];
-  auto min_utilization = std::numeric_limits<double>::max();
-
-  for (auto&& servant : servants) {
-	if (!filter(servant)) {
-	  continue;
-	}
-	double utilization = double(servant->running_tasks / servant->servant_info.concurrency); // 线程利用率
-	if (utilization < min_utilization) {
-	  min_utilization = utilization;
-	  result = servant;
-	}
-  }
-
-  return result;
-}
-
 } // namespace distribuild::scheduler
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "common/cache_format.h"
+#include "daemon/cache.h"
+
+#include "gtest/gtest.h"
+
+using namespace distribuild;
+
+namespace {
+
+constexpr std::size_t kFileCountOffset = offsetof(CacheHeaderV2, file_count);
+
+std::string MakeEntry() {
+  daemon::CacheEntry entry;
+  entry.exit_code = 1;
+  entry.std_out = "out";
+  entry.std_err = "warning: unused variable";
+  entry.files = {{".o", "object file"}, {".gcno", ""}, {".d", "deps"}};
+  entry.compile_cost_ms = 1234;
+  auto data = daemon::TryMakeCacheData(std::move(entry));
+  EXPECT_TRUE(data);
+  return data.value_or("");
+}
+
+} // namespace
+
+TEST(CacheFormatTest, EncodeParse) {
+  auto data = MakeEntry();
+  auto view = TryParseCacheEntryView(data);
+  ASSERT_TRUE(view);
+  EXPECT_EQ(view->meta.exit_code(), 1);
+  EXPECT_EQ(view->meta.stdout(), "out");
+  EXPECT_EQ(view->meta.stderr(), "warning: unused variable");
+  EXPECT_EQ(view->meta.compile_cost_ms(), 1234);
+  ASSERT_EQ(view->files.size(), 3);
+  EXPECT_EQ(view->files[0].first, ".o");
+  EXPECT_EQ(view->files[0].second, "object file");
+  EXPECT_EQ(view->files[1].first, ".gcno");
+  EXPECT_EQ(view->files[1].second, "");
+  EXPECT_EQ(view->files[2].first, ".d");
+  EXPECT_EQ(view->files[2].second, "deps");
+  // 文件内容指向原数据，不复制
+  EXPECT_GE(view->files[0].second.data(), data.data());
+  EXPECT_LE(view->files[2].second.data() + view->files[2].second.size(), data.data() + data.size());
+
+  auto entry = daemon::TryParseCacheEntry(std::move(data));
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(entry->exit_code, 1);
+  EXPECT_EQ(entry->compile_cost_ms, 1234);
+  ASSERT_EQ(entry->files.size(), 3);
+  EXPECT_EQ(entry->files[2].second, "deps");
+}
+
+TEST(CacheFormatTest, EncodeParseWithoutFiles) {
+  daemon::CacheEntry entry;
+  entry.exit_code = 0;
+  auto data = daemon::TryMakeCacheData(std::move(entry));
+  ASSERT_TRUE(data);
+  auto view = TryParseCacheEntryView(*data);
+  ASSERT_TRUE(view);
+  EXPECT_EQ(view->meta.exit_code(), 0);
+  EXPECT_TRUE(view->files.empty());
+}
+
+TEST(CacheFormatTest, TruncatedHeaderOrMeta) {
+  auto data = MakeEntry();
+  EXPECT_FALSE(TryParseCacheEntryView(std::string_view(data).substr(0, sizeof(CacheHeaderV2) - 1)));
+  EXPECT_FALSE(TryParseCacheEntryView(std::string_view(data).substr(0, sizeof(CacheHeaderV2) + 1)));
+}
+
+TEST(CacheFormatTest, TruncatedFileTable) {
+  auto data = MakeEntry();
+  // 头部不在校验范围内，改大file_count后文件表超出数据末尾
+  std::uint16_t file_count = 1000;
+  memcpy(data.data() + kFileCountOffset, &file_count, sizeof(file_count));
+  EXPECT_FALSE(TryParseCacheEntryView(data));
+}
+
+TEST(CacheFormatTest, TruncatedContents) {
+  auto data = MakeEntry();
+  data.pop_back();
+  EXPECT_FALSE(TryParseCacheEntryView(data));
+}
+
+TEST(CacheFormatTest, HashMismatch) {
+  auto data = MakeEntry();
+  data.back() ^= 1;
+  EXPECT_FALSE(TryParseCacheEntryView(data));
+  EXPECT_FALSE(daemon::TryParseCacheEntry(std::move(data)));
+}
+
+TEST(CacheFormatTest, SkipHashCheck) {
+  auto data = MakeEntry();
+  data.back() ^= 1;
+  auto view = TryParseCacheEntryView(data, false);
+  ASSERT_TRUE(view);
+  ASSERT_EQ(view->files.size(), 3);
+  EXPECT_EQ(view->files[0].second, "object file");
+  // 只跳过内容校验，文件表仍需完整
+  EXPECT_FALSE(TryParseCacheEntryView(std::string_view(data).substr(0, data.size() - 1), false));
+}
+
+TEST(CacheFormatTest, BadMagicOrVersion) {
+  auto data = MakeEntry();
+  auto bad_magic = data;
+  bad_magic[0] ^= 1;
+  EXPECT_FALSE(TryParseCacheEntryView(bad_magic));
+
+  std::uint16_t version = kCacheVersion + 1;
+  memcpy(data.data() + offsetof(CacheHeaderV2, version), &version, sizeof(version));
+  EXPECT_FALSE(TryParseCacheEntryView(data));
+}
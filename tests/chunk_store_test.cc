@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cache/chunk_store.h"
+#include "common/dir.h"
+
+#include "gtest/gtest.h"
+
+using distribuild::cache::ChunkStore;
+
+namespace {
+
+constexpr std::size_t kManifestHeaderSize = 4 + sizeof(std::uint64_t);
+constexpr std::size_t kIdSize = 16;
+constexpr std::size_t kManifestChunkSize = kIdSize + sizeof(std::uint32_t);
+
+class ChunkStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char temp[] = "/tmp/chunk_store_test_XXXXXX";
+    ASSERT_NE(mkdtemp(temp), nullptr);
+    dir_ = temp;
+    distribuild::Mkdirs(TempDir());
+  }
+
+  void TearDown() override { distribuild::RemoveDir(dir_); }
+
+  std::string ChunkDir() const { return dir_ + "/chunks"; }
+  std::string TempDir() const { return dir_ + "/temp"; }
+
+  /// @brief 分多次追加写入一个条目，返回清单
+  static std::string Write(ChunkStore* store, const std::string& bytes) {
+    ChunkStore::Writer writer(store);
+    for (std::size_t i = 0; i < bytes.size(); i += 10'000) {
+      EXPECT_TRUE(writer.Append(std::string_view(bytes).substr(i, 10'000)));
+    }
+    auto manifest = writer.Finish();
+    EXPECT_TRUE(manifest);
+    return manifest.value_or("");
+  }
+
+  std::string dir_;
+};
+
+/// @brief 固定种子的随机数据，不同进程间相同
+std::string MakeData(std::size_t size, std::uint64_t seed = 1) {
+  std::mt19937_64 engine(seed);
+  std::string result(size, '\0');
+  for (auto&& e : result) {
+    e = static_cast<char>(engine());
+  }
+  return result;
+}
+
+/// @brief 清单中按顺序排列的块ID
+std::vector<std::string> ChunkIds(const std::string& manifest) {
+  std::vector<std::string> result;
+  for (auto i = kManifestHeaderSize; i + kManifestChunkSize <= manifest.size(); i += kManifestChunkSize) {
+    result.push_back(manifest.substr(i, kIdSize));
+  }
+  return result;
+}
+
+std::string ReadAll(ChunkStore* store, const std::string& manifest) {
+  auto buffer = store->Read(manifest);
+  return buffer ? buffer->ToString() : "";
+}
+
+} // namespace
+
+TEST_F(ChunkStoreTest, SameContentSameChunks) {
+  ChunkStore store(ChunkDir(), TempDir());
+  auto data = MakeData(1 << 20);
+  auto first = Write(&store, data);
+  auto second = Write(&store, data);
+
+  EXPECT_EQ(first, second);
+  EXPECT_GT(ChunkIds(first).size(), 1);
+  EXPECT_EQ(ChunkStore::GetEntrySize(first), data.size());
+  // 相同的块只存一份
+  EXPECT_EQ(store.GetSize(), data.size());
+  EXPECT_EQ(ReadAll(&store, second), data);
+}
+
+TEST_F(ChunkStoreTest, OneByteEditChangesNeighboringChunks) {
+  ChunkStore store(ChunkDir(), TempDir());
+  auto data = MakeData(1 << 20);
+  auto edited = data;
+  edited[edited.size() / 2] ^= 1;
+
+  auto original_ids = ChunkIds(Write(&store, data));
+  auto edited_manifest = Write(&store, edited);
+  auto edited_ids = ChunkIds(edited_manifest);
+
+  // 分块边界由内容决定，修改只影响所在的块，最多波及下一个块
+  std::size_t changed = 0;
+  for (auto&& e : edited_ids) {
+    changed += std::find(original_ids.begin(), original_ids.end(), e) == original_ids.end();
+  }
+  EXPECT_GE(changed, 1);
+  EXPECT_LE(changed, 2);
+  EXPECT_EQ(edited_ids.front(), original_ids.front());
+  EXPECT_EQ(edited_ids.back(), original_ids.back());
+  EXPECT_EQ(ReadAll(&store, edited_manifest), edited);
+}
+
+TEST_F(ChunkStoreTest, RefsSurviveRestart) {
+  auto data = MakeData(1 << 20);
+  auto other = MakeData(256 << 10, 2);
+  std::string kept, dropped;
+  std::size_t kept_size;
+  {
+    ChunkStore store(ChunkDir(), TempDir());
+    kept = Write(&store, data);
+    kept_size = store.GetSize();
+    dropped = Write(&store, other);
+    EXPECT_EQ(store.GetSize(), data.size() + other.size());
+  }
+
+  // 重启后只扫描到kept的清单，dropped的清单在停机期间丢失
+  ChunkStore store(ChunkDir(), TempDir());
+  EXPECT_EQ(store.GetSize(), data.size() + other.size());
+  ASSERT_TRUE(store.AddRefs(kept));
+  store.RemoveUnreferenced();
+  EXPECT_EQ(store.GetSize(), kept_size);
+  EXPECT_EQ(ReadAll(&store, kept), data);
+  EXPECT_FALSE(store.Read(dropped));
+
+  // 重建的引用与写入时相同，释放后块被删除
+  store.Release(kept);
+  EXPECT_EQ(store.GetSize(), 0);
+  EXPECT_FALSE(store.Read(kept));
+}
+
+TEST_F(ChunkStoreTest, SharedChunksSurviveRelease) {
+  ChunkStore store(ChunkDir(), TempDir());
+  auto data = MakeData(1 << 20);
+  auto extended = data + MakeData(128 << 10, 3);
+  auto first = Write(&store, data);
+  auto second = Write(&store, extended);
+  EXPECT_LT(store.GetSize(), data.size() + extended.size());
+
+  // 第二个条目仍引用共享的块
+  store.Release(first);
+  EXPECT_EQ(ReadAll(&store, second), extended);
+  EXPECT_GE(store.GetSize(), extended.size());
+
+  store.Release(second);
+  EXPECT_EQ(store.GetSize(), 0);
+  EXPECT_FALSE(store.Read(second));
+}
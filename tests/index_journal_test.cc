@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cache/index_journal.h"
+#include "common/dir.h"
+
+#include "gtest/gtest.h"
+
+using distribuild::cache::IndexJournal;
+
+namespace {
+
+constexpr std::size_t kFileMagicSize = 8;
+constexpr std::size_t kRecordHeaderSize = sizeof(std::uint32_t) + sizeof(std::uint64_t);
+
+class IndexJournalTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char temp[] = "/tmp/index_journal_test_XXXXXX";
+    ASSERT_NE(mkdtemp(temp), nullptr);
+    dir_ = temp;
+  }
+
+  void TearDown() override { distribuild::RemoveDir(dir_); }
+
+  std::string JournalPath() const { return dir_ + "/index.journal"; }
+
+  std::string ReadJournal() const {
+    std::ifstream ifs(JournalPath(), std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+  }
+
+  void WriteJournal(const std::string& bytes) const {
+    std::ofstream ofs(JournalPath(), std::ios::binary | std::ios::trunc);
+    ofs.write(bytes.data(), bytes.size());
+  }
+
+  /// @brief 写入records并关闭日志
+  void Write(const std::vector<IndexJournal::Record>& records) const {
+    IndexJournal journal(dir_);
+    ASSERT_TRUE(journal.Open());
+    for (auto&& e : records) {
+      journal.Append(e);
+    }
+    journal.Flush();
+  }
+
+  /// @brief 回放并按key排序
+  std::optional<std::vector<IndexJournal::Record>> Replay() const {
+    IndexJournal journal(dir_);
+    auto result = journal.Replay();
+    if (result) {
+      std::sort(result->begin(), result->end(), [](auto&& a, auto&& b) { return a.key < b.key; });
+    }
+    return result;
+  }
+
+  std::string dir_;
+};
+
+IndexJournal::Record MakeRecord(std::string key, std::uint64_t size, bool removed = false) {
+  IndexJournal::Record result;
+  result.removed = removed;
+  result.key = std::move(key);
+  result.size = size;
+  result.cost_ms = 100;
+  result.atime = 1700000000;
+  return result;
+}
+
+} // namespace
+
+TEST_F(IndexJournalTest, ReplayWithoutFiles) {
+  EXPECT_FALSE(Replay());
+}
+
+TEST_F(IndexJournalTest, RoundTrip) {
+  Write({MakeRecord("a", 1), MakeRecord("b", 2), MakeRecord("c", 3),
+         MakeRecord("a", 10), MakeRecord("b", 0, true)});
+
+  auto records = Replay();
+  ASSERT_TRUE(records);
+  ASSERT_EQ(records->size(), 2);
+  EXPECT_EQ((*records)[0].key, "a");
+  EXPECT_EQ((*records)[0].size, 10);
+  EXPECT_EQ((*records)[0].cost_ms, 100);
+  EXPECT_EQ((*records)[0].atime, 1700000000);
+  EXPECT_FALSE((*records)[0].removed);
+  EXPECT_EQ((*records)[1].key, "c");
+  EXPECT_EQ((*records)[1].size, 3);
+}
+
+TEST_F(IndexJournalTest, RoundTripThroughSnapshot) {
+  Write({MakeRecord("a", 1), MakeRecord("b", 2)});
+  {
+    IndexJournal journal(dir_);
+    auto records = journal.Replay();
+    ASSERT_TRUE(records);
+    ASSERT_TRUE(journal.Open());
+    ASSERT_TRUE(journal.Rotate());
+    journal.Append(MakeRecord("c", 3));
+    journal.Append(MakeRecord("a", 0, true));
+    journal.Flush();
+    ASSERT_TRUE(journal.WriteSnapshot(*records));
+  }
+  EXPECT_NE(access((dir_ + "/index.snapshot").c_str(), F_OK), -1);
+  EXPECT_EQ(access((dir_ + "/index.journal.old").c_str(), F_OK), -1);
+
+  auto records = Replay();
+  ASSERT_TRUE(records);
+  ASSERT_EQ(records->size(), 2);
+  EXPECT_EQ((*records)[0].key, "b");
+  EXPECT_EQ((*records)[1].key, "c");
+}
+
+TEST_F(IndexJournalTest, TornTail) {
+  Write({MakeRecord("a", 1), MakeRecord("b", 2)});
+  auto intact = ReadJournal();
+  Write({MakeRecord("c", 3)});
+  auto bytes = ReadJournal();
+  ASSERT_GT(bytes.size(), intact.size() + 1);
+  // 进程崩溃时只写了最后一条记录的一部分
+  WriteJournal(bytes.substr(0, bytes.size() - 1));
+
+  auto records = Replay();
+  ASSERT_TRUE(records);
+  ASSERT_EQ(records->size(), 2);
+  EXPECT_EQ((*records)[0].key, "a");
+  EXPECT_EQ((*records)[1].key, "b");
+  // 损坏的尾部被截断，之后追加的记录可以被回放
+  EXPECT_EQ(ReadJournal(), intact);
+
+  Write({MakeRecord("d", 4)});
+  records = Replay();
+  ASSERT_TRUE(records);
+  ASSERT_EQ(records->size(), 3);
+  EXPECT_EQ((*records)[2].key, "d");
+}
+
+TEST_F(IndexJournalTest, CorruptChecksum) {
+  Write({MakeRecord("a", 1)});
+  auto first_size = ReadJournal().size();
+  Write({MakeRecord("b", 2), MakeRecord("c", 3)});
+  auto bytes = ReadJournal();
+  // 改写第二条记录payload中的一个字节，校验和不再匹配，回放到此为止
+  bytes[first_size + kRecordHeaderSize] ^= 1;
+  WriteJournal(bytes);
+
+  auto records = Replay();
+  ASSERT_TRUE(records);
+  ASSERT_EQ(records->size(), 1);
+  EXPECT_EQ((*records)[0].key, "a");
+  EXPECT_EQ(ReadJournal().size(), first_size);
+}
+
+TEST_F(IndexJournalTest, UnknownMagic) {
+  Write({MakeRecord("a", 1)});
+  auto bytes = ReadJournal();
+  ASSERT_GT(bytes.size(), kFileMagicSize);
+  bytes[0] ^= 1;
+  WriteJournal(bytes);
+
+  auto records = Replay();
+  ASSERT_TRUE(records);
+  EXPECT_TRUE(records->empty());
+}
@@ -0,0 +1,208 @@
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+
+#include "scheduler/task_dispatcher.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+using namespace distribuild;
+using namespace distribuild::scheduler;
+
+namespace {
+
+constexpr auto kDigest = "digest";
+constexpr auto kExpiresIn = 10s;
+
+ServantInfo MakeServant(std::string location, std::size_t concurrency, std::uint32_t version = 1,
+                        ServantPriority priority = ServantPriority::SERVANT_PRIORITY_DEDICATED) {
+  ServantInfo result;
+  result.version = version;
+  result.observed_location = location;
+  result.reported_location = std::move(location);
+  result.num_cpu_cores = 64;
+  result.current_load = 0;
+  result.total_memory_in_bytes = 0; // 不按内存限制
+  result.avail_memory_in_bytes = 0;
+  result.concurrency = concurrency;
+  result.priority = priority;
+  result.env_decs.emplace_back().set_compiler_digest(kDigest);
+  return result;
+}
+
+TaskInfo MakeTask(std::uint32_t min_version = 1) {
+  TaskInfo result;
+  result.requester_ip = "10.0.0.1";
+  result.min_version = min_version;
+  result.env_desc.set_compiler_digest(kDigest);
+  return result;
+}
+
+/// @brief 不等待，只在有空闲名额时分配
+std::optional<TaskAllocation> TryStart(TaskDispatcher* dispatcher, const TaskInfo& task_info,
+                                       bool prefetching = false) {
+  return dispatcher->WaitForStartingNewTask(task_info, kExpiresIn, std::chrono::steady_clock::now(), prefetching).first;
+}
+
+/// @brief 在另一个线程中等待分配，返回后等待者已排进队列
+std::future<std::optional<TaskAllocation>> StartWaiting(TaskDispatcher* dispatcher, const TaskInfo& task_info,
+                                                        std::chrono::milliseconds timeout = 10s) {
+  auto result = std::async(std::launch::async, [=] {
+    return dispatcher->WaitForStartingNewTask(task_info, kExpiresIn, std::chrono::steady_clock::now() + timeout,
+                                              false).first;
+  });
+  std::this_thread::sleep_for(100ms); // 等待者按调用顺序排队
+  return result;
+}
+
+bool IsReady(const std::future<std::optional<TaskAllocation>>& future) {
+  return future.wait_for(0s) == std::future_status::ready;
+}
+
+} // namespace
+
+TEST(TaskDispatcherTest, AllocateToFreeServant) {
+  TaskDispatcher dispatcher;
+  auto task_info = MakeTask();
+  auto [allocation, status] = dispatcher.WaitForStartingNewTask(task_info, kExpiresIn,
+                                                                std::chrono::steady_clock::now(), false);
+  EXPECT_EQ(status, WaitStatus::EnvNotFound);
+
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 2), 10s);
+  auto first = TryStart(&dispatcher, task_info);
+  auto second = TryStart(&dispatcher, task_info);
+  ASSERT_TRUE(first && second);
+  EXPECT_NE(first->task_id, second->task_id);
+  EXPECT_EQ(first->servant_location, "10.0.0.2:8000");
+  EXPECT_FALSE(TryStart(&dispatcher, task_info)); // 名额已用完
+}
+
+TEST(TaskDispatcherTest, FreedSlotGoesToOldestWaiter) {
+  TaskDispatcher dispatcher;
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 1), 10s);
+  auto task_info = MakeTask();
+  auto running = TryStart(&dispatcher, task_info);
+  ASSERT_TRUE(running);
+
+  auto oldest = StartWaiting(&dispatcher, task_info);
+  auto newest = StartWaiting(&dispatcher, task_info);
+  EXPECT_FALSE(IsReady(oldest));
+  EXPECT_FALSE(IsReady(newest));
+
+  // 释放的名额交给等待最久的请求，后来的请求继续等待
+  dispatcher.FreeTask({running->task_id});
+  auto first = oldest.get();
+  ASSERT_TRUE(first);
+  EXPECT_FALSE(newest.wait_for(100ms) == std::future_status::ready);
+
+  dispatcher.FreeTask({first->task_id});
+  EXPECT_TRUE(newest.get());
+}
+
+TEST(TaskDispatcherTest, TimedOutWaiterLeavesQueue) {
+  TaskDispatcher dispatcher;
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 1), 10s);
+  auto task_info = MakeTask();
+  auto running = TryStart(&dispatcher, task_info);
+  ASSERT_TRUE(running);
+
+  auto start = std::chrono::steady_clock::now();
+  auto [allocation, status] = dispatcher.WaitForStartingNewTask(task_info, kExpiresIn, start + 100ms, false);
+  EXPECT_FALSE(allocation);
+  EXPECT_EQ(status, WaitStatus::Timeout);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 100ms);
+
+  // 超时的请求已移出队列，释放的名额不会分给它
+  dispatcher.FreeTask({running->task_id});
+  EXPECT_TRUE(TryStart(&dispatcher, task_info));
+}
+
+TEST(TaskDispatcherTest, ZeroTimeoutPrefetch) {
+  TaskDispatcher dispatcher;
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 1), 10s);
+  auto task_info = MakeTask();
+  auto prefetched = TryStart(&dispatcher, task_info, true);
+  ASSERT_TRUE(prefetched);
+
+  // 没有空闲名额时立即返回，不留在队列中
+  auto start = std::chrono::steady_clock::now();
+  auto [allocation, status] = dispatcher.WaitForStartingNewTask(task_info, kExpiresIn, start, true);
+  EXPECT_FALSE(allocation);
+  EXPECT_EQ(status, WaitStatus::Timeout);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 1s);
+
+  dispatcher.FreeTask({prefetched->task_id});
+  EXPECT_TRUE(TryStart(&dispatcher, task_info, true));
+}
+
+TEST(TaskDispatcherTest, SkipWaiterWithVersionMismatch) {
+  TaskDispatcher dispatcher;
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 1, 1), 10s);
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.3:8000", 1, 2), 10s);
+  auto old_task = MakeTask(1);  // 只能使用版本1的节点
+  auto new_task = MakeTask(2);
+  auto on_old = TryStart(&dispatcher, old_task);
+  auto on_new = TryStart(&dispatcher, new_task);
+  ASSERT_TRUE(on_old && on_new);
+  ASSERT_EQ(on_old->servant_location, "10.0.0.2:8000");
+  ASSERT_EQ(on_new->servant_location, "10.0.0.3:8000");
+
+  auto old_waiter = StartWaiting(&dispatcher, old_task);
+  auto new_waiter = StartWaiting(&dispatcher, new_task);
+
+  // 排在前面的请求无法使用空出的节点，名额交给后面的请求
+  dispatcher.FreeTask({on_new->task_id});
+  auto allocation = new_waiter.get();
+  ASSERT_TRUE(allocation);
+  EXPECT_EQ(allocation->servant_location, "10.0.0.3:8000");
+  EXPECT_FALSE(IsReady(old_waiter));
+
+  dispatcher.FreeTask({on_old->task_id});
+  allocation = old_waiter.get();
+  ASSERT_TRUE(allocation);
+  EXPECT_EQ(allocation->servant_location, "10.0.0.2:8000");
+}
+
+TEST(TaskDispatcherTest, PreferDedicatedAndLessLoadedServant) {
+  TaskDispatcher dispatcher;
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 4, 1, ServantPriority::SERVANT_PRIORITY_USER), 10s);
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.3:8000", 4), 10s);
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.1:8000", 4), 10s); // 请求者自己的节点
+  auto task_info = MakeTask();
+
+  // 专用节点利用率低于一半时优先
+  for (int i = 0; i < 2; ++i) {
+    auto allocation = TryStart(&dispatcher, task_info);
+    ASSERT_TRUE(allocation);
+    EXPECT_EQ(allocation->servant_location, "10.0.0.3:8000");
+  }
+  // 之后按利用率，空闲的用户节点在前
+  auto allocation = TryStart(&dispatcher, task_info);
+  ASSERT_TRUE(allocation);
+  EXPECT_EQ(allocation->servant_location, "10.0.0.2:8000");
+
+  // 其他节点都满了才使用请求者自己的节点
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(TryStart(&dispatcher, task_info));
+  }
+  allocation = TryStart(&dispatcher, task_info);
+  ASSERT_TRUE(allocation);
+  EXPECT_EQ(allocation->servant_location, "10.0.0.1:8000");
+}
+
+TEST(TaskDispatcherTest, ExtendedTaskIsNotZombie) {
+  TaskDispatcher dispatcher;
+  dispatcher.KeepServantAlive(MakeServant("10.0.0.2:8000", 2), 10s);
+  auto task_info = MakeTask();
+  auto extended = dispatcher.WaitForStartingNewTask(task_info, 100ms, std::chrono::steady_clock::now(), false).first;
+  auto expired = dispatcher.WaitForStartingNewTask(task_info, 100ms, std::chrono::steady_clock::now(), false).first;
+  ASSERT_TRUE(extended && expired);
+  EXPECT_EQ(dispatcher.KeepTaskAlive({extended->task_id}, 10s), std::vector<bool>{true});
+
+  // 过期堆中仍是原来的过期时间，弹出时发现已被延长，不标记为僵尸
+  std::this_thread::sleep_for(2500ms);
+  EXPECT_EQ(dispatcher.KeepTaskAlive({extended->task_id, expired->task_id}, 10s),
+            (std::vector<bool>{true, false}));
+}